@@ -0,0 +1,282 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "AsyncIO.h"
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#endif
+
+//
+// io_uring state. the ring is set up on the first batch; if that fails
+// (old kernel, or io_uring disabled) the thread pool is used instead.
+//
+static const int RING_ENTRIES = 64;
+
+static enum { UNKNOWN, URING, THREADS } backend = UNKNOWN;
+
+// one batch runs at a time; the ring and the worker queue are shared
+static pthread_mutex_t batchLock = PTHREAD_MUTEX_INITIALIZER;
+
+#ifdef __linux__
+static struct {
+  int               fd;       // the ring file descriptor
+  unsigned*         sqTail;   // submission queue tail, written by us
+  unsigned*         sqMask;
+  unsigned*         sqArray;  // indexes into sqes
+  struct io_uring_sqe* sqes;  // submission queue entries
+  unsigned*         cqHead;   // completion queue head, written by us
+  unsigned*         cqTail;
+  unsigned*         cqMask;
+  struct io_uring_cqe* cqes;  // completion queue entries
+  unsigned          entries;  // # submission queue entries
+} ring;
+#endif
+
+//
+// thread pool state. the workers pick reads off a shared queue.
+//
+static const int WORKER_COUNT = 8;
+
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  poolWork = PTHREAD_COND_INITIALIZER;   // reads queued
+static pthread_cond_t  poolDone = PTHREAD_COND_INITIALIZER;   // reads finished
+static AsyncIO::Request* poolQueue = 0;  // the batch being worked on
+static int poolNext = 0;                 // next read of the batch to start
+static int poolCount = 0;                // # reads in the batch
+static int poolFinished = 0;             // # reads of the batch finished
+static bool poolStarted = false;
+static int poolWorkers = 0;              // # workers that could be started
+
+
+RC AsyncIO::readBatch(Request* reqs, int count)
+{
+  RC rc;
+  if (count <= 0) return 0;
+
+  pthread_mutex_lock(&batchLock);
+  if (backend == UNKNOWN) backend = setupUring() ? URING : THREADS;
+  rc = (backend == URING) ? readUring(reqs, count) : readThreads(reqs, count);
+  pthread_mutex_unlock(&batchLock);
+
+  return rc;
+}
+
+const char* AsyncIO::getBackendName()
+{
+  pthread_mutex_lock(&batchLock);
+  if (backend == UNKNOWN) backend = setupUring() ? URING : THREADS;
+  pthread_mutex_unlock(&batchLock);
+  return (backend == URING) ? "io_uring" : "threads";
+}
+
+void AsyncIO::disableUring()
+{
+  pthread_mutex_lock(&batchLock);
+  backend = THREADS;
+  pthread_mutex_unlock(&batchLock);
+}
+
+bool AsyncIO::setupUring()
+{
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+
+  int fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &p);
+  if (fd < 0) return false;
+
+  // map the submission ring, the completion ring and the entries
+  size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  bool single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && cqSize > sqSize) sqSize = cqSize;
+
+  char* sq = (char*)mmap(0, sqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                         fd, IORING_OFF_SQ_RING);
+  if (sq == MAP_FAILED) { close(fd); return false; }
+
+  char* cq = sq;
+  if (!single) {
+    cq = (char*)mmap(0, cqSize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     fd, IORING_OFF_CQ_RING);
+    if (cq == MAP_FAILED) { munmap(sq, sqSize); close(fd); return false; }
+  }
+
+  void* sqes = mmap(0, p.sq_entries * sizeof(struct io_uring_sqe),
+                    PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) {
+    if (!single) munmap(cq, cqSize);
+    munmap(sq, sqSize);
+    close(fd);
+    return false;
+  }
+
+  ring.fd = fd;
+  ring.sqTail = (unsigned*)(sq + p.sq_off.tail);
+  ring.sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+  ring.sqArray = (unsigned*)(sq + p.sq_off.array);
+  ring.sqes = (struct io_uring_sqe*)sqes;
+  ring.cqHead = (unsigned*)(cq + p.cq_off.head);
+  ring.cqTail = (unsigned*)(cq + p.cq_off.tail);
+  ring.cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+  ring.entries = p.sq_entries;
+  return true;
+#else
+  return false;
+#endif
+}
+
+RC AsyncIO::readUring(Request* reqs, int count)
+{
+#if defined(__linux__) && defined(__NR_io_uring_setup)
+  int submitted = 0;   // # reads put in the submission queue
+  int queued = 0;      // # of those the kernel has not taken yet
+  int completed = 0;
+  bool failed = false;
+
+  // a read has failed until its completion says otherwise
+  for (int i = 0; i < count; i++) reqs[i].rc = RC_FILE_READ_FAILED;
+
+  while (completed < submitted || (!failed && submitted < count)) {
+    // fill the submission queue with as many reads as there are free slots
+    int inFlight = submitted - completed;
+    unsigned tail = *ring.sqTail;
+    while (!failed && submitted < count && inFlight + queued < (int)ring.entries) {
+      Request& r = reqs[submitted];
+      unsigned index = tail & *ring.sqMask;
+      struct io_uring_sqe* sqe = &ring.sqes[index];
+
+      // the iovec of a read is in its request, so it stays untouched
+      // until the read completes, in whatever order the reads complete
+      r.iov.iov_base = r.buffer;
+      r.iov.iov_len = r.length;
+
+      memset(sqe, 0, sizeof(*sqe));
+      sqe->opcode = IORING_OP_READV;
+      sqe->fd = r.fd;
+      sqe->off = r.offset;
+      sqe->addr = (unsigned long)&r.iov;
+      sqe->len = 1;
+      sqe->user_data = submitted;
+      ring.sqArray[index] = index;
+
+      tail++;
+      submitted++;
+      queued++;
+    }
+    __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+
+    // submit the new reads and wait for at least one completion
+    int taken = syscall(__NR_io_uring_enter, ring.fd, queued, 1,
+                        IORING_ENTER_GETEVENTS, NULL, 0);
+    if (taken < 0) {
+      if (errno == EINTR) continue;
+      if (failed) break;  // cannot even wait; nothing else to try
+
+      // take back the reads the kernel has not seen, so that the next
+      // batch does not submit them, and wait for the ones in flight,
+      // since they are still reading into the buffers
+      __atomic_store_n(ring.sqTail, tail - queued, __ATOMIC_RELEASE);
+      submitted -= queued;
+      queued = 0;
+      failed = true;
+      continue;
+    }
+    queued -= taken;
+
+    // collect the completed reads
+    unsigned head = *ring.cqHead;
+    while (head != __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe* cqe = &ring.cqes[head & *ring.cqMask];
+      Request& r = reqs[cqe->user_data];
+      r.rc = (cqe->res == r.length) ? 0 : RC_FILE_READ_FAILED;
+      head++;
+      completed++;
+    }
+    __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (reqs[i].rc < 0) return reqs[i].rc;
+  }
+  return 0;
+#else
+  return readThreads(reqs, count);
+#endif
+}
+
+static void* worker(void*)
+{
+  pthread_mutex_lock(&poolLock);
+  while (true) {
+    while (poolNext >= poolCount) pthread_cond_wait(&poolWork, &poolLock);
+    AsyncIO::Request& r = poolQueue[poolNext++];
+    pthread_mutex_unlock(&poolLock);
+
+    ssize_t n = pread(r.fd, r.buffer, r.length, r.offset);
+    r.rc = (n == r.length) ? 0 : RC_FILE_READ_FAILED;
+
+    pthread_mutex_lock(&poolLock);
+    if (++poolFinished == poolCount) pthread_cond_signal(&poolDone);
+  }
+  return 0;
+}
+
+RC AsyncIO::readThreads(Request* reqs, int count)
+{
+  pthread_mutex_lock(&poolLock);
+
+  // start the workers on the first batch
+  if (!poolStarted) {
+    for (int i = 0; i < WORKER_COUNT; i++) {
+      pthread_t t;
+      if (pthread_create(&t, NULL, worker, NULL) == 0) {
+        pthread_detach(t);
+        poolWorkers++;
+      }
+    }
+    poolStarted = true;
+  }
+
+  // without a single worker, the reads are done here one at a time
+  if (poolWorkers == 0) {
+    pthread_mutex_unlock(&poolLock);
+    RC rc = 0;
+    for (int i = 0; i < count; i++) {
+      ssize_t n = pread(reqs[i].fd, reqs[i].buffer, reqs[i].length, reqs[i].offset);
+      reqs[i].rc = (n == reqs[i].length) ? 0 : RC_FILE_READ_FAILED;
+      if (reqs[i].rc < 0 && rc == 0) rc = reqs[i].rc;
+    }
+    return rc;
+  }
+
+  // hand the batch to the workers and wait until all reads are done
+  poolQueue = reqs;
+  poolNext = 0;
+  poolFinished = 0;
+  poolCount = count;
+  pthread_cond_broadcast(&poolWork);
+  while (poolFinished < poolCount) pthread_cond_wait(&poolDone, &poolLock);
+  poolQueue = 0;
+  poolCount = 0;
+  poolNext = 0;
+
+  pthread_mutex_unlock(&poolLock);
+
+  for (int i = 0; i < count; i++) {
+    if (reqs[i].rc < 0) return reqs[i].rc;
+  }
+  return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef ASYNCIO_H
+#define ASYNCIO_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "Bruinbase.h"
+
+/**
+ * issue many disk reads at once and wait for all of them.
+ * on Linux kernels with io_uring, the reads are submitted to one ring so
+ * the device sees all of them together. otherwise a small pool of
+ * threads runs them with pread().
+ */
+class AsyncIO {
+ public:
+
+  /**
+   * one read of a batch
+   */
+  struct Request {
+    int    fd;      // the file to read from
+    off_t  offset;  // the offset in the file to read at
+    void*  buffer;  // the memory to read into
+    int    length;  // # bytes to read
+    RC     rc;      // [OUT] 0 if all length bytes were read
+    struct iovec iov;  // used by the batch while the read is in flight
+  };
+
+  /**
+   * submit all reads in reqs and return when every one of them has
+   * completed. the reads may complete in any order.
+   * @param reqs[IN/OUT] the reads. rc of each is set on completion
+   * @param count[IN] # reads in reqs
+   * @return error code. 0 if every read succeeded
+   */
+  static RC readBatch(Request* reqs, int count);
+
+  /**
+   * @return "io_uring" or "threads", the mechanism used for batches
+   */
+  static const char* getBackendName();
+
+  /**
+   * stop using io_uring and run batches on the thread pool.
+   */
+  static void disableUring();
+
+ private:
+  static RC readUring(Request* reqs, int count);
+  static RC readThreads(Request* reqs, int count);
+
+  static bool setupUring();
+};
+
+#endif // ASYNCIO_H
@@ -9,6 +9,8 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <algorithm>
+#include <vector>
 
 using namespace std;
 
@@ -19,6 +21,12 @@ BTreeIndex::BTreeIndex()
 {
     rootPid = -1;
     treeHeight = 0;
+    extentNext[0] = extentNext[1] = -1;
+    extentEnd[0] = extentEnd[1] = -1;
+    bulkFanout = bulkLeafFill = 0;
+    bulkInsert = false;
+    bulkLastKey = 0;
+    bulkLeafPid = -1;
 }
 
 /*
@@ -35,7 +43,7 @@ RC BTreeIndex::open(const string& indexname, char mode)
    		//cerr << "Error opening" << endl;
    		return ret;
    	}
-   	char buffer[PageFile::PAGE_SIZE];
+   	char buffer[PageFile::MAX_PAGE_SIZE];
    	ret = pf.read(0, buffer);
    	if(ret != 0) {
    		// RC_INVALID_PID is an expected return value if this is a new tree
@@ -47,6 +55,10 @@ RC BTreeIndex::open(const string& indexname, char mode)
    	}
    	memcpy(&rootPid, buffer, sizeof(PageId));
    	memcpy(&treeHeight, buffer + sizeof(PageId), sizeof(int));
+   	// indexes written before extents were used have 0xFFs (-1) here,
+   	// which makes the next node start a new extent
+   	memcpy(extentNext, buffer + sizeof(PageId) + sizeof(int), sizeof(extentNext));
+   	memcpy(extentEnd, buffer + sizeof(PageId) + sizeof(int) + sizeof(extentNext), sizeof(extentEnd));
    	return 0;
 }
 
@@ -56,10 +68,12 @@ RC BTreeIndex::open(const string& indexname, char mode)
  */
 RC BTreeIndex::close()
 {
-	char buffer[PageFile::PAGE_SIZE];
-	memset(buffer, 0xFF, PageFile::PAGE_SIZE);
+	char buffer[PageFile::MAX_PAGE_SIZE];
+	memset(buffer, 0xFF, pf.getPageSize());
 	memcpy(buffer, &rootPid, sizeof(PageId));
 	memcpy(buffer + sizeof(PageId), &treeHeight, sizeof(int));
+	memcpy(buffer + sizeof(PageId) + sizeof(int), extentNext, sizeof(extentNext));
+	memcpy(buffer + sizeof(PageId) + sizeof(int) + sizeof(extentNext), extentEnd, sizeof(extentEnd));
 	RC ret = pf.write(0, buffer);
 	if(ret != 0) {
 		//cerr << "Error closing" << endl;
@@ -79,29 +93,27 @@ RC BTreeIndex::close()
    * @param sibling_key[OUT] the first key of the newly create sibling, or unchanged if no sibling created
   */
 RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int height, PageId& sibling_pid, int& sibling_key) {
-	int pair_size_leaf = sizeof(RecordId) + sizeof(int);
-	int pair_size_non = sizeof(PageId) + sizeof(int);
 	RC error;
 	if(height == treeHeight) {
 		// base case - we're at a leaf, so insert (and split if needed)
 		BTLeafNode node;
 
-		error = node.read(pid, pf);
+		error = node.readForWrite(pid, pf);
 		if(error != 0) {
 			//cerr << "Error reading leaf node in tree insert" << endl;
 			return error;
 		}
 
 		// node needs to split
-		if(node.getKeyCount() >= (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size_leaf) {
-			BTLeafNode sibling;
+		if(node.getKeyCount() >= leafNodeCapacity(pf.getPageSize())) {
+			BTLeafNode sibling(pf.getPageSize());
 
 			error = node.insertAndSplit(key, rid, sibling, sibling_key);
 			if(error != 0) {
 				//cerr << "Error inserting and splitting leaf node in tree insert" << endl;
 				return error;
 			}
-			sibling_pid = pf.endPid();
+			sibling_pid = allocatePage(true);
 			if(sibling_pid < 2) {
 				// since 0 is BTreeIndex variables and 1 is the first leaf node, we know that the pid must be at least 2 now
 				//cerr << "Invalid PageId for sibling in tree insert" << endl;
@@ -145,7 +157,7 @@ RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int he
 	// traverse the tree to the leaf
 	BTNonLeafNode node;
 
-	error = node.read(pid, pf);
+	error = node.readForWrite(pid, pf);
 	if(error != 0) {
 		//cerr << "Error reading nonleaf node in tree insert" << endl;
 		return error;
@@ -171,8 +183,8 @@ RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int he
 
 	// if needed, insert new key
 	// if needed, split and return new PageId
-	if(node.getKeyCount() >= (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size_non) {
-		BTNonLeafNode sibling;
+	if(node.getKeyCount() >= nonLeafNodeCapacity(pf.getPageSize())) {
+		BTNonLeafNode sibling(pf.getPageSize());
 
 		error = node.insertAndSplit(s_key, s_pid, sibling, sibling_key);
 		if(error != 0) {
@@ -180,7 +192,7 @@ RC BTreeIndex::insert_recursive(int key, const RecordId& rid, PageId pid, int he
 			return error;
 		}
 
-		sibling_pid = pf.endPid();
+		sibling_pid = allocatePage(false);
 		if(sibling_pid < 2) {
 			// since 0 is BTreeIndex variables and 1 is the first leaf node, we know that the pid must be at least 2 now
 			//cerr << "Invalid PageId for sibling in tree insert" << endl;
@@ -233,13 +245,11 @@ RC BTreeIndex::insert(int key, const RecordId& rid) {
 	RC error;
 	// trivial case - no tree, create a new one
 	if(treeHeight == 0) {
-		BTLeafNode root;
+		BTLeafNode root(pf.getPageSize());
 		root.insert(key, rid);
-		rootPid = pf.endPid();
-		// location cannot be negative, and page 0 is reserved for the variables of the B+ tree itself
-		if(rootPid <= 0) {
-			rootPid = 1;
-		}
+		// page 0 is reserved for the variables of the B+ tree itself,
+		// so the first extent starts at page 1
+		rootPid = allocatePage(true);
 		treeHeight = 1;
 
 		error = root.write(rootPid, pf);
@@ -259,9 +269,9 @@ RC BTreeIndex::insert(int key, const RecordId& rid) {
 			return error;
 		}
 		if(sibling_pid != -1 && sibling_key != -1) {
-			BTNonLeafNode new_root;
+			BTNonLeafNode new_root(pf.getPageSize());
 			new_root.initializeRoot(rootPid, sibling_key, sibling_pid);
-			rootPid = pf.endPid();
+			rootPid = allocatePage(false);
 			if(rootPid < 2) {
 				// since 0 is BTreeIndex variables and 1 is the first leaf node, we know that the rootPid must be at least 2 now
 				//cerr << "Incorrect root pid value in tree insert" << endl;
@@ -279,6 +289,149 @@ RC BTreeIndex::insert(int key, const RecordId& rid) {
 	}
 }
 
+/*
+ * Build the index bottom-up from entries sorted by key.
+ * @param entries[IN] the entries, in increasing order of key
+ * @param count[IN] # entries
+ * @param fillPercent[IN] how full to fill each node, from 1 to 100
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::beginBulkLoad(int fillPercent) {
+	if(fillPercent < 1 || fillPercent > 100) {
+		return RC_INVALID_ATTRIBUTE;
+	}
+	int pageSize = pf.getPageSize();
+	bulkLeafFill = std::max(leafNodeCapacity(pageSize) * fillPercent / 100, 1);
+	bulkFanout = std::max((nonLeafNodeCapacity(pageSize) + 1) * fillPercent / 100, 3);
+	// the nodes of an existing tree are already laid out, so add to them
+	bulkInsert = (treeHeight != 0);
+	bulkLastKey = 0;
+	bulkLeafPid = -1;
+	bulkLeaf.clear();
+	bulkLevels.clear();
+	return 0;
+}
+
+RC BTreeIndex::bulkAdd(int key, const RecordId& rid) {
+	RC error;
+	if(key < 0 || key < bulkLastKey) {
+		//cerr << "Invalid or unsorted key in tree bulkAdd" << endl;
+		return RC_INVALID_ATTRIBUTE;
+	}
+	if(rid.pid < 0 || rid.sid < 0) {
+		//cerr << "Invalid rid in tree bulkAdd" << endl;
+		return RC_INVALID_RID;
+	}
+	bulkLastKey = key;
+	if(bulkInsert) {
+		return insert(key, rid);
+	}
+
+	// a full leaf is written when the first entry of the next leaf comes,
+	// whose page is then allocated so that the next-node pointer can be
+	// set. equal keys stay in one leaf if they fit, since locate() finds
+	// the first of them in the leaf to the right of the separator.
+	int size = bulkLeaf.size();
+	if(size >= bulkLeafFill && (key != bulkLeaf.back().key
+	                            || size >= leafNodeCapacity(pf.getPageSize()))) {
+		PageId next = allocatePage(true);
+		if((error = writeBulkLeaf(next)) != 0) {
+			return error;
+		}
+		bulkLeafPid = next;
+	}
+	if(bulkLeafPid < 0) {
+		bulkLeafPid = allocatePage(true);
+	}
+	IndexEntry entry = { key, rid };
+	bulkLeaf.push_back(entry);
+	return 0;
+}
+
+RC BTreeIndex::finishBulkLoad() {
+	RC error;
+	if(bulkInsert || bulkLeafPid < 0) {
+		return 0;
+	}
+	if((error = writeBulkLeaf(-1)) != 0) {
+		return error;
+	}
+	bulkLeafPid = -1;
+
+	// the children left at each level go to one or two last nodes, from
+	// the bottom up, until a level has a single node: the root
+	for(int level = 0; ; level++) {
+		int children = bulkLevels[level].size();
+		if(level + 1 == (int)bulkLevels.size() && children == 1) {
+			rootPid = bulkLevels[level][0].second;
+			treeHeight = level + 1;
+			break;
+		}
+		int nodes = (children + bulkFanout - 1) / bulkFanout;
+		for(int n = 0; n < nodes; n++) {
+			if((error = writeBulkNode(level, bulkLevels[level].size() / (nodes - n))) != 0) {
+				return error;
+			}
+		}
+	}
+	bulkLevels.clear();
+	return 0;
+}
+
+RC BTreeIndex::writeBulkLeaf(PageId next) {
+	RC error;
+	BTLeafNode leaf(pf.getPageSize());
+	for(unsigned i = 0; i < bulkLeaf.size(); i++) {
+		if((error = leaf.insert(bulkLeaf[i].key, bulkLeaf[i].rid)) != 0) {
+			return error;
+		}
+	}
+	if(next >= 0 && (error = leaf.setNextNodePtr(next)) != 0) {
+		return error;
+	}
+	if((error = leaf.write(bulkLeafPid, pf)) != 0) {
+		//cerr << "Error writing leaf node in tree bulkAdd" << endl;
+		return error;
+	}
+	int first = bulkLeaf[0].key;
+	bulkLeaf.clear();
+	return addBulkChild(0, first, bulkLeafPid);
+}
+
+RC BTreeIndex::addBulkChild(int level, int key, PageId pid) {
+	if((int)bulkLevels.size() == level) {
+		bulkLevels.push_back(std::vector<std::pair<int, PageId> >());
+	}
+	bulkLevels[level].push_back(std::make_pair(key, pid));
+	// the fanout children that stay behind are spread over the last
+	// nodes by finishBulkLoad()
+	if((int)bulkLevels[level].size() == 2 * bulkFanout) {
+		return writeBulkNode(level, bulkFanout);
+	}
+	return 0;
+}
+
+RC BTreeIndex::writeBulkNode(int level, int count) {
+	RC error;
+	std::vector<std::pair<int, PageId> >& children = bulkLevels[level];
+	BTNonLeafNode node(pf.getPageSize());
+	node.initializeRoot(children[0].second, children[1].first, children[1].second);
+	for(int k = 2; k < count; k++) {
+		if((error = node.insert(children[k].first, children[k].second)) != 0) {
+			return error;
+		}
+	}
+	PageId pid = allocatePage(false);
+	if((error = node.write(pid, pf)) != 0) {
+		//cerr << "Error writing nonleaf node in tree bulkAdd" << endl;
+		return error;
+	}
+	int first = children[0].first;
+	children.erase(children.begin(), children.begin() + count);
+	// the call may reallocate the levels, which children points into
+	return addBulkChild(level + 1, first, pid);
+}
+
 RC BTreeIndex::locate_recursive(int searchKey, IndexCursor& cursor, PageId pid, int height) {
 	// if at leaf level of tree, search for value
 	if(height == treeHeight) {
@@ -290,6 +443,12 @@ RC BTreeIndex::locate_recursive(int searchKey, IndexCursor& cursor, PageId pid,
 			RC found = node.locate(searchKey, eid);
 			if(found == RC_NO_SUCH_RECORD && eid == node.getKeyCount()) {
 				node_pid = node.getNextNodePtr();
+				// searchKey is larger than every key in the tree
+				if(node_pid < 0) {
+					cursor.pid = -1;
+					cursor.eid = 0;
+					return RC_NO_SUCH_RECORD;
+				}
 			}
 			else {
 				cursor.pid = node_pid;
@@ -327,6 +486,12 @@ RC BTreeIndex::locate_recursive(int searchKey, IndexCursor& cursor, PageId pid,
  * @return 0 if searchKey is found. Othewise an error code*/
  
 RC BTreeIndex::locate(int searchKey, IndexCursor& cursor) {
+	// an empty tree has no leaf. readForward() ends at once.
+	if(treeHeight == 0) {
+		cursor.pid = -1;
+		cursor.eid = 0;
+		return RC_NO_SUCH_RECORD;
+	}
 	return locate_recursive(searchKey, cursor, rootPid, 1);
 }
 
@@ -339,6 +504,9 @@ RC BTreeIndex::locate(int searchKey, IndexCursor& cursor) {
  * @return error code. 0 if no error
  */
 RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid) {
+	if(cursor.pid < 0) {
+		return RC_END_OF_TREE;
+	}
 	BTLeafNode node;
 	node.read(cursor.pid, pf);
 	RC error = node.readEntry(cursor.eid, key, rid);
@@ -350,15 +518,174 @@ RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid) {
 		return 0;
 	}
 	else {
+		// after the last leaf the pid is -1, and the next call ends the scan
 		cursor.eid = 0;
 		cursor.pid = node.getNextNodePtr();
-		if(cursor.pid == 0xFFFFFFFFFFFFFFFF) {
-			return RC_END_OF_TREE;
-		}
 		return 0;
 	}
 }
 
+/*
+ * Allocate the page of a new node from the current extent of its kind.
+ * @param leaf[IN] true for a leaf node, false for a nonleaf node
+ * @return the PageId of the new node
+ */
+PageId BTreeIndex::allocatePage(bool leaf) {
+	// free pages come back in increasing order after clear(), so the
+	// leaves of a reloaded index are still mostly in order
+	PageId pid;
+	if(pf.getFreePageCount() > 0 && pf.allocatePage(pid) == 0) {
+		return pid;
+	}
+
+	int kind = leaf ? 1 : 0;
+	if(extentNext[kind] < 0 || extentNext[kind] >= extentEnd[kind]) {
+		// the new extent starts after the pages written so far and after
+		// the (partly unused) extents of both kinds
+		PageId start = std::max(pf.endPid(), (PageId)1);
+		start = std::max(start, std::max(extentEnd[0], extentEnd[1]));
+		extentNext[kind] = start;
+		extentEnd[kind] = start + std::max(EXTENT_SIZE / pf.getPageSize(), 1);
+	}
+	return extentNext[kind]++;
+}
+
+/*
+ * Remove all entries, freeing the pages of the nodes.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::clear() {
+	// every page belongs to the tree, so the file is emptied instead of
+	// putting its pages on the free list. page 0 is written again by
+	// close().
+	RC error = pf.truncate();
+	if(error != 0) {
+		return error;
+	}
+
+	rootPid = -1;
+	treeHeight = 0;
+	extentNext[0] = extentNext[1] = -1;
+	extentEnd[0] = extentEnd[1] = -1;
+	return 0;
+}
+
+/*
+ * Rewrite the leaf nodes in key order among the pages they occupy.
+ * @return error code. 0 if no error
+ */
+RC BTreeIndex::reorganize() {
+	RC error;
+	// a tree of a single leaf is already in order
+	if(treeHeight <= 1) {
+		return 0;
+	}
+
+	// collect the nonleaf nodes right above the leaves, level by level
+	std::vector<PageId> parents(1, rootPid);
+	for(int height = 1; height < treeHeight - 1; height++) {
+		std::vector<PageId> children;
+		for(unsigned i = 0; i < parents.size(); i++) {
+			BTNonLeafNode node;
+			if((error = node.read(parents[i], pf)) != 0) {
+				return error;
+			}
+			for(int c = 0; c <= node.getKeyCount(); c++) {
+				children.push_back(node.getChildPtr(c));
+			}
+		}
+		parents.swap(children);
+	}
+
+	// the leaves in key order, following the next-node pointers from
+	// the first leaf. a chain longer than the file means it is broken.
+	std::vector<PageId> leaves;
+	BTNonLeafNode first;
+	if((error = first.read(parents[0], pf)) != 0) {
+		return error;
+	}
+	PageId pid = first.getChildPtr(0);
+	while(pid >= 0) {
+		if(pid >= pf.endPid() || (PageId)leaves.size() >= pf.endPid()) {
+			return RC_INVALID_FILE_FORMAT;
+		}
+		leaves.push_back(pid);
+		BTLeafNode leaf;
+		if((error = leaf.read(pid, pf)) != 0) {
+			return error;
+		}
+		pid = leaf.getNextNodePtr();
+	}
+
+	// the i'th leaf in key order moves to the i'th smallest of the pages
+	// occupied by leaves. position[pid] is the key order of the leaf now
+	// stored in page pid.
+	std::vector<PageId> slots(leaves);
+	std::sort(slots.begin(), slots.end());
+	std::vector<int> position(pf.endPid(), -1);
+	for(unsigned i = 0; i < leaves.size(); i++) {
+		position[leaves[i]] = i;
+	}
+
+	// point the parents to the new pages of their children
+	for(unsigned i = 0; i < parents.size(); i++) {
+		BTNonLeafNode node;
+		if((error = node.readForWrite(parents[i], pf)) != 0) {
+			return error;
+		}
+		for(int c = 0; c <= node.getKeyCount(); c++) {
+			PageId child = node.getChildPtr(c);
+			if(child >= 0 && child < pf.endPid() && position[child] >= 0) {
+				node.setChildPtr(c, slots[position[child]]);
+			}
+		}
+		if((error = node.write(parents[i], pf)) != 0) {
+			return error;
+		}
+	}
+
+	// move the leaves along the cycles of the permutation, so that every
+	// page is read and written once and only two pages are held at a time.
+	// the next-node pointer is the last field of a leaf page.
+	int pageSize = pf.getPageSize();
+	int nextOffset = pageSize - sizeof(PageId);
+	char moving[PageFile::MAX_PAGE_SIZE];
+	char evicted[PageFile::MAX_PAGE_SIZE];
+	std::vector<bool> moved(leaves.size(), false);
+	for(unsigned i = 0; i < leaves.size(); i++) {
+		if(moved[i]) {
+			continue;
+		}
+		if((error = pf.read(leaves[i], moving)) != 0) {
+			return error;
+		}
+		int current = i;
+		while(true) {
+			PageId next = (current + 1 < (int)leaves.size()) ? slots[current + 1] : -1;
+			memcpy(moving + nextOffset, &next, sizeof(PageId));
+			moved[current] = true;
+
+			// the leaf in the target page moves next, unless it already has
+			PageId target = slots[current];
+			int occupant = position[target];
+			if(!moved[occupant]) {
+				if((error = pf.read(target, evicted)) != 0) {
+					return error;
+				}
+			}
+			if((error = pf.write(target, moving)) != 0) {
+				return error;
+			}
+			if(moved[occupant]) {
+				break;
+			}
+			memcpy(moving, evicted, pageSize);
+			current = occupant;
+		}
+	}
+	return 0;
+}
+
 void BTreeIndex::print_path(int key) {
 	cout << "Tree: " << endl;
 	if(treeHeight == 0) {
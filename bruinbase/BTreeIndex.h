@@ -10,9 +10,9 @@
 #ifndef BTREEINDEX_H
 #define BTREEINDEX_H
 
-#define KEYS_PER_NODE 70
-
 #include <iostream>
+#include <utility>
+#include <vector>
 
 #include <string.h>
 
@@ -33,12 +33,31 @@ typedef struct {
   int     eid;  
 } IndexCursor;
 
+/**
+ * A (key, RecordId) pair of the index, as given to BTreeIndex::bulkAdd().
+ */
+typedef struct {
+  // the key of the entry
+  int      key;
+  // the RecordId of the record with the key
+  RecordId rid;
+} IndexEntry;
+
 /**
  * Implements a B-Tree index for bruinbase.
  * 
  */
 class BTreeIndex {
  public:
+  /// new nodes are given pages from extents of this many bytes, with
+  /// leaves and nonleaf nodes in separate extents. an extent is as large
+  /// as a read-ahead, so a scan reads the leaves of an extent at once.
+  static const int EXTENT_SIZE = PageFile::READ_AHEAD_SIZE;
+
+  /// the percentage of the entries of a node that a bulk load fills by
+  /// default. the room left lets a later insert() go in without a split.
+  static const int DEFAULT_FILL = 90;
+
   BTreeIndex();
 
   /**
@@ -75,6 +94,37 @@ class BTreeIndex {
    */
   RC insert(int key, const RecordId& rid);
 
+  /**
+   * Start to build the index bottom-up from entries sorted by key, which
+   * are then given one at a time to bulkAdd() and end with
+   * finishBulkLoad(). The leaves are filled in key order and written to
+   * consecutive pages of the leaf extents, and a nonleaf node is written
+   * as soon as its children are. Only the leaf being filled and a few
+   * nodes of children per level are held in memory. The tree has the
+   * smallest height the fill factor allows, and a scan of the leaves
+   * reads their pages in order.
+   * If the index already has entries, the entries are inserted one at a
+   * time instead. The index must be open in 'w' mode.
+   * @param fillPercent[IN] how full to fill each node, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  RC beginBulkLoad(int fillPercent = DEFAULT_FILL);
+
+  /**
+   * Add the next entry of the bulk load started by beginBulkLoad().
+   * @param key[IN] the key of the entry, not smaller than the last one
+   * @param rid[IN] the RecordId of the entry
+   * @return error code. RC_INVALID_ATTRIBUTE if the key is negative or
+   *         out of order
+   */
+  RC bulkAdd(int key, const RecordId& rid);
+
+  /**
+   * Write the last nodes of the bulk load and set the root.
+   * @return error code. 0 if no error
+   */
+  RC finishBulkLoad();
+
   // recursive function for locating
   RC locate_recursive(int searchKey, IndexCursor& cursor, PageId pid, int height);
   /**
@@ -107,17 +157,86 @@ class BTreeIndex {
    */
   RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
 
+  /**
+   * Rewrite the leaf nodes in key order, so that following the
+   * next-node pointers from the first leaf reads pages in increasing
+   * PageId order and readForward() scans become sequential reads.
+   * The leaves are moved among the pages they already occupy, and the
+   * pointers of their parents are updated. The index must be open in
+   * 'w' mode.
+   * @return error code. 0 if no error
+   */
+  RC reorganize();
+
+  /**
+   * Remove all entries. The file is truncated, and page 0 is written
+   * again by close(). The index must be open in 'w' mode.
+   * @return error code. 0 if no error
+   */
+  RC clear();
+
   void print_path(int key);
   
  private:
+  /**
+   * Allocate the page of a new node. A page on the free list of the
+   * PageFile is reused first. Otherwise the page comes from the current
+   * extent of its kind, and a new extent is started at the end of the
+   * file when it is used up.
+   * @param leaf[IN] true for a leaf node, false for a nonleaf node
+   * @return the PageId of the new node
+   */
+  PageId allocatePage(bool leaf);
+
+  /**
+   * Write the leaf of the bulk load and add it to the children of the
+   * lowest nonleaf level.
+   * @param next[IN] the page of the next leaf. -1 for the last leaf
+   * @return error code. 0 if no error
+   */
+  RC writeBulkLeaf(PageId next);
+
+  /**
+   * Add a node to the children waiting for their parent at a level of the
+   * bulk load, and write a parent once 2 * fanout children wait, so that
+   * the last parents of the level get at least two children each.
+   * @param level[IN] the level of the parent, 0 for the lowest nonleaf level
+   * @param key[IN] the smallest key under the node
+   * @param pid[IN] the page of the node
+   * @return error code. 0 if no error
+   */
+  RC addBulkChild(int level, int key, PageId pid);
+
+  /**
+   * Write a nonleaf node of the bulk load over the first children waiting
+   * at a level, and add it to the level above.
+   * @param level[IN] the level of the node
+   * @param count[IN] # children of the node
+   * @return error code. 0 if no error
+   */
+  RC writeBulkNode(int level, int count);
+
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
 
   PageId   rootPid;    /// the PageId of the root node
   int      treeHeight; /// the height of the tree
+  PageId   extentNext[2]; /// the next free page of the current nonleaf [0]
+                          /// and leaf [1] extents
+  PageId   extentEnd[2];  /// the end of the current extents. -1 if none
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
   /// is opened again later.
+
+  int      bulkFanout;    /// # children of a nonleaf node in a bulk load
+  int      bulkLeafFill;  /// # entries of a leaf in a bulk load
+  bool     bulkInsert;    /// true if the bulk load inserts into the tree
+  int      bulkLastKey;   /// the last key given to bulkAdd()
+  PageId   bulkLeafPid;   /// the page of the leaf being filled. -1 if none
+  std::vector<IndexEntry> bulkLeaf; /// the entries of that leaf
+  /// the first key and page of the nodes waiting for a parent, per level
+  std::vector<std::vector<std::pair<int, PageId> > > bulkLevels;
 };
 
 #endif /* BTREEINDEX_H */
\ No newline at end of file
@@ -3,9 +3,11 @@
 using namespace std;
 
 //constructor, fills the buffer with 0s
-BTLeafNode::BTLeafNode() {
+BTLeafNode::BTLeafNode(int size) {
 	//0xFF is the empty buffer
-	memset(buffer, 0xFF, PageFile::PAGE_SIZE);
+	pageSize = size;
+	buffer = storage;
+	memset(buffer, 0xFF, pageSize);
 }
 /*
  * Read the content of the node from the page pid in the PageFile pf.
@@ -14,7 +16,32 @@ BTLeafNode::BTLeafNode() {
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::read(PageId pid, const PageFile& pf) {
-	return pf.read(pid, buffer);
+	RC error = pf.pin(pid, page);
+	if(error != 0) {
+		buffer = storage;
+		return error;
+	}
+	// the node is a read-only view, it is never modified through buffer
+	buffer = const_cast<char*>(page.data());
+	pageSize = pf.getPageSize();
+	return 0;
+}
+
+/*
+ * Make the node a writable view of the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTLeafNode::readForWrite(PageId pid, PageFile& pf) {
+	RC error = pf.pinForWrite(pid, page);
+	if(error != 0) {
+		buffer = storage;
+		return error;
+	}
+	buffer = page.writableData();
+	pageSize = pf.getPageSize();
+	return 0;
 }
     
 /*
@@ -24,6 +51,15 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf) {
  * @return 0 if successful. Return an error code if there is an error.
  */
 RC BTLeafNode::write(PageId pid, PageFile& pf) {
+	// a writable view of the page is in the buffer pool. it is marked dirty
+	// again, since the pool may have written it back while it was pinned.
+	if(buffer == page.writableData() && page.holds(pf, pid)) {
+		page.markDirty();
+		return 0;
+	}
+	if(pageSize != pf.getPageSize()) {
+		return RC_INVALID_FILE_FORMAT;
+	}
 	return pf.write(pid, buffer);
 }
 
@@ -35,11 +71,17 @@ int BTLeafNode::getKeyCount() {
 	//cout << "getKeyCount start" << endl;
 	int count = 0;
 	int pair_size = sizeof(RecordId) + sizeof(int);
-	int max_count = (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size;
+	int max_count = leafNodeCapacity(pageSize);
 
 	while(true) {
-		//cout << (int)buffer[count * pair_size] << endl;
-		if(count + 1 > max_count || (int)buffer[count * pair_size] == -1) {
+		// an unused entry is all 0xFF. compare the whole pid, since a
+		// page id such as 255 also has a 0xFF byte.
+		PageId pid;
+		if(count + 1 > max_count) {
+			break;
+		}
+		memcpy(&pid, buffer + count * pair_size, sizeof(PageId));
+		if(pid == -1) {
 			break;
 		}
 		count++;
@@ -57,7 +99,7 @@ RC BTLeafNode::insert(int key, const RecordId& rid) {
 	//cout << "Insert start" << endl;
 	int count = getKeyCount();
 	int pair_size = sizeof(RecordId) + sizeof(int);
-	if(count * pair_size >= PageFile::PAGE_SIZE - sizeof(PageId)) {
+	if(count * pair_size >= pageSize - sizeof(PageId)) {
 		//cout << "Node full" << endl;
 		return RC_NODE_FULL;
 	}
@@ -65,7 +107,7 @@ RC BTLeafNode::insert(int key, const RecordId& rid) {
 	int pos = 0;
 	locate(key, pos);
 	// to insert into the middle, copy everything after to another buffer, insert, and copy back
-	int copy_size = PageFile::PAGE_SIZE - (pos * pair_size) - sizeof(PageId) - pair_size;
+	int copy_size = pageSize - (pos * pair_size) - sizeof(PageId) - pair_size;
 	char temp_buffer[copy_size];
 	memcpy(temp_buffer, buffer + (pos * pair_size), copy_size);
 	// insert rid
@@ -97,7 +139,7 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 	int pair_size = sizeof(RecordId) + sizeof(int);
 
 	// create buffer that contains buffer and inserted data, sorted correctly
-	int size_of_temp = PageFile::PAGE_SIZE + sizeof(RecordId) + sizeof(int);
+	int size_of_temp = pageSize + sizeof(RecordId) + sizeof(int);
 	char temp_buffer[size_of_temp];
 	int pos = 0;
 	locate(key, pos);
@@ -108,7 +150,7 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 	memcpy(temp_buffer + (pos * pair_size), &rid, sizeof(RecordId));
 	memcpy(temp_buffer + (pos * pair_size) + sizeof(RecordId), &key, sizeof(int));
 	// copy over rest of buffer
-	memcpy(temp_buffer + ((pos + 1) * pair_size), buffer + pos * pair_size, PageFile::PAGE_SIZE - pos * pair_size);
+	memcpy(temp_buffer + ((pos + 1) * pair_size), buffer + pos * pair_size, pageSize - pos * pair_size);
 
 	// debugging print loop
 	for(int i = 0; i < size_of_temp/pair_size; i++) {
@@ -138,8 +180,10 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 	// cout << endl;
 	// copy over nextNodePtr
 	sibling.setNextNodePtr(getNextNodePtr());
+	// the first half comes from temp_buffer too, since the new pair may be in it
+	memcpy(buffer, temp_buffer, first_half * pair_size);
 	// set second half of current node buffer to be empty again
-	memset(buffer + (first_half * pair_size), 0xFF, PageFile::PAGE_SIZE - (first_half * pair_size) - sizeof(PageId));
+	memset(buffer + (first_half * pair_size), 0xFF, pageSize - (first_half * pair_size) - sizeof(PageId));
 	// we can't set the nextNodePtr here because we don't have that information, BTreeIndex should handle this
 	// set siblingKey to first key in sibling
 	memcpy(&siblingKey, sibling.buffer + sizeof(RecordId), sizeof(int));
@@ -197,7 +241,7 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid) {
  */
 PageId BTLeafNode::getNextNodePtr() { 
 	PageId next_ptr;
-	memcpy(&next_ptr, buffer + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+	memcpy(&next_ptr, buffer + pageSize - sizeof(PageId), sizeof(PageId));
 	return next_ptr;
 }
 
@@ -210,7 +254,7 @@ RC BTLeafNode::setNextNodePtr(PageId pid) {
 	if(pid < 0) {
 		return RC_INVALID_PID;
 	}
-	memcpy(buffer + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
+	memcpy(buffer + pageSize - sizeof(PageId), &pid, sizeof(PageId));
 	return 0;
 }
 
@@ -218,7 +262,7 @@ void BTLeafNode::print_node() {
 	cout << "Leaf node" << endl;
 	int pair_size = sizeof(RecordId) + sizeof(int);
 	int empty_pairs = 0;
-	for(int i = 0; i < (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size; i++) {
+	for(int i = 0; i < leafNodeCapacity(pageSize); i++) {
 		RecordId rid;
 		int key;
 		memcpy(&rid, buffer + (i * pair_size), sizeof(RecordId));
@@ -227,20 +271,22 @@ void BTLeafNode::print_node() {
 			empty_pairs++;
 		}
 		else {
-			cout << "Rid: " << rid.pid << ", " << rid.sid << "; key: " << key << " at " << (unsigned int)(buffer + (i * pair_size)) << endl;
+			cout << "Rid: " << rid.pid << ", " << rid.sid << "; key: " << key << " at " << (void*)(buffer + (i * pair_size)) << endl;
 		}
 	}
 	cout << "Empty pairs: " << empty_pairs << endl;
 	PageId next_ptr;
-	memcpy(&next_ptr, buffer + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+	memcpy(&next_ptr, buffer + pageSize - sizeof(PageId), sizeof(PageId));
 	cout << "Next pointer: " << next_ptr << endl << endl;
 }
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-BTNonLeafNode::BTNonLeafNode()
+BTNonLeafNode::BTNonLeafNode(int size)
 {
 	//0xFF is the empty buffer
-	memset(buffer, 0xFF, PageFile::PAGE_SIZE);
+	pageSize = size;
+	buffer = storage;
+	memset(buffer, 0xFF, pageSize);
 }
 
 /*
@@ -251,7 +297,33 @@ BTNonLeafNode::BTNonLeafNode()
  */
 RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 {
-	return pf.read(pid, buffer);
+	RC error = pf.pin(pid, page);
+	if(error != 0) {
+		buffer = storage;
+		return error;
+	}
+	// the node is a read-only view, it is never modified through buffer
+	buffer = const_cast<char*>(page.data());
+	pageSize = pf.getPageSize();
+	return 0;
+}
+
+/*
+ * Make the node a writable view of the page pid in the PageFile pf.
+ * @param pid[IN] the PageId to read
+ * @param pf[IN] PageFile to read from
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::readForWrite(PageId pid, PageFile& pf)
+{
+	RC error = pf.pinForWrite(pid, page);
+	if(error != 0) {
+		buffer = storage;
+		return error;
+	}
+	buffer = page.writableData();
+	pageSize = pf.getPageSize();
+	return 0;
 }
     
 /*
@@ -262,6 +334,15 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
  */
 RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 {
+	// a writable view of the page is in the buffer pool. it is marked dirty
+	// again, since the pool may have written it back while it was pinned.
+	if(buffer == page.writableData() && page.holds(pf, pid)) {
+		page.markDirty();
+		return 0;
+	}
+	if(pageSize != pf.getPageSize()) {
+		return RC_INVALID_FILE_FORMAT;
+	}
 	return pf.write(pid, buffer);
 }
 
@@ -273,11 +354,17 @@ int BTNonLeafNode::getKeyCount()
 {
 	int count = 0;
 	int pair_size = sizeof(PageId) + sizeof(int);
-	int max_count = (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size;
+	int max_count = nonLeafNodeCapacity(pageSize);
 
 	while(true) 
 	{
-		if(count + 1 > max_count || (int)buffer[count * pair_size + sizeof(PageId)] == -1) 
+		// an unused entry is all 0xFF. compare the whole key, since a
+		// key such as 255 also has a 0xFF byte.
+		int key;
+		if(count + 1 > max_count) 
+			break;
+		memcpy(&key, buffer + count * pair_size + sizeof(PageId), sizeof(int));
+		if(key == -1) 
 			break;
 		count++;
 	}
@@ -299,7 +386,7 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 	int key_count = 0;
 	int num_keys = getKeyCount();
 	int pair_size = sizeof(PageId) + sizeof(int);
-	if((num_keys + 1)* pair_size >= PageFile::PAGE_SIZE - sizeof(PageId)) {
+	if((num_keys + 1)* pair_size >= pageSize - sizeof(PageId)) {
 		//cout << "Node full" << endl;
 		return RC_NODE_FULL;
 	}
@@ -309,7 +396,7 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 
 	PageId current_pid = -2;
 
-	while(pos < PageFile::PAGE_SIZE - 2*sizeof(PageId) && key_count != num_keys) 
+	while(pos < pageSize - 2*sizeof(PageId) && key_count != num_keys) 
 	{
 		int current_key;
 		memcpy(&current_key, buffer + pos + sizeof(PageId), sizeof(int));
@@ -319,7 +406,7 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 		key_count++;
 	}
 	// to insert into the middle, copy everything after to another buffer, insert, and copy back
-	int copy_size = PageFile::PAGE_SIZE - pos - sizeof(PageId);
+	int copy_size = pageSize - pos - sizeof(PageId);
 	char temp_buffer[copy_size];
 	memcpy(temp_buffer, buffer + pos + sizeof(PageId), copy_size);
 	// insert key
@@ -352,7 +439,7 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 	int first_half = (count + 1)/2;
 	int half_ind = first_half*8;
 	int pair_size = sizeof(PageId) + sizeof(int);
-	int max_count = (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size;
+	int max_count = nonLeafNodeCapacity(pageSize);
 
 
 	// can have 3 potential medians to give to midKey
@@ -373,23 +460,23 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 	{
 		midKey = key;
 		// put right half of node in sibling
-		memcpy(sibling.buffer+4, buffer + half_ind - sizeof(int), PageFile::PAGE_SIZE - half_ind + sizeof(int));
+		memcpy(sibling.buffer+4, buffer + half_ind - sizeof(int), pageSize - half_ind + sizeof(int));
 		memcpy(sibling.buffer, &pid, sizeof(PageId)); // sibling first pid becomes pid of mid
 		memset(buffer + half_ind - sizeof(int), 0xFF, half_ind - sizeof(int)); // set rest of currNode as -1
 	}
 	else if(potKey1 > key) // potKey1 is median
 	{
 		midKey = potKey1;
-		memcpy(sibling.buffer, buffer + half_ind - pair_size, PageFile::PAGE_SIZE - half_ind + pair_size);
-		memset(buffer + half_ind - pair_size, 0xFF, PageFile::PAGE_SIZE - half_ind + pair_size);
+		memcpy(sibling.buffer, buffer + half_ind - pair_size, pageSize - half_ind + pair_size);
+		memset(buffer + half_ind - pair_size, 0xFF, pageSize - half_ind + pair_size);
 		insert(key, pid); // insert the pairing into current buffer, could be anywhere
 
 	}
 	else // at this point potKey2 has to to be the median, since key > potKey2, also means key goes into first ind of sibling
 	{
 		midKey = potKey2;
-		memcpy(sibling.buffer, buffer + half_ind, PageFile::PAGE_SIZE - half_ind);
-		memset(buffer + half_ind, 0xFF, PageFile::PAGE_SIZE - half_ind);
+		memcpy(sibling.buffer, buffer + half_ind, pageSize - half_ind);
+		memset(buffer + half_ind, 0xFF, pageSize - half_ind);
 		sibling.insert(key, pid);
 
 	}
@@ -438,6 +525,35 @@ RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
 
 	return 0;
 }
+/*
+ * Return the i'th child-node pointer.
+ * @param i[IN] the number of the pointer, from 0 to getKeyCount()
+ * @return the PageId of the child node
+ */
+PageId BTNonLeafNode::getChildPtr(int i)
+{
+	int pair_size = sizeof(PageId) + sizeof(int);
+	PageId pid;
+	memcpy(&pid, buffer + (i * pair_size), sizeof(PageId));
+	return pid;
+}
+
+/*
+ * Replace the i'th child-node pointer.
+ * @param i[IN] the number of the pointer, from 0 to getKeyCount()
+ * @param pid[IN] the new PageId of the child node
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RC BTNonLeafNode::setChildPtr(int i, PageId pid)
+{
+	if(i < 0 || i > getKeyCount() || pid < 0) {
+		return RC_INVALID_PID;
+	}
+	int pair_size = sizeof(PageId) + sizeof(int);
+	memcpy(buffer + (i * pair_size), &pid, sizeof(PageId));
+	return 0;
+}
+
 void BTNonLeafNode::print_node() {
 	cout << "Non Leaf node" << endl;
 	cout << "KeyCount: " << getKeyCount() << endl;
@@ -445,7 +561,7 @@ void BTNonLeafNode::print_node() {
 	int pair_size = sizeof(PageId) + sizeof(int);
 	int empty_pairs = 0;
 
-	for(int i = 0; i < (PageFile::PAGE_SIZE - sizeof(PageId))/pair_size; i++) 
+	for(int i = 0; i < nonLeafNodeCapacity(pageSize); i++) 
 	{
 		PageId pid;
 		int key;
@@ -455,7 +571,7 @@ void BTNonLeafNode::print_node() {
 			empty_pairs++;
 		}
 		else {
-			cout << "Pid: " << pid << ", " << "; key: " << key << " at " << (unsigned int)(buffer + (i * pair_size)) << endl;
+			cout << "Pid: " << pid << ", " << "; key: " << key << " at " << (void*)(buffer + (i * pair_size)) << endl;
 		}
 	}
 	cout << "Num pairs left: " << empty_pairs << endl;
@@ -17,13 +17,33 @@
 #include "RecordFile.h"
 #include "PageFile.h"
 
+/**
+ * The number of (rid, key) entries that fit in a leaf node stored in a
+ * page of pageSize bytes. The last sizeof(PageId) bytes of the page hold
+ * the pointer to the next sibling.
+ */
+constexpr int leafNodeCapacity(int pageSize)
+{
+  return (pageSize - sizeof(PageId)) / (sizeof(RecordId) + sizeof(int));
+}
+
+/**
+ * The number of (pid, key) pairs that fit in a nonleaf node stored in a
+ * page of pageSize bytes, after the leading sizeof(PageId) bytes that
+ * hold the first child pointer.
+ */
+constexpr int nonLeafNodeCapacity(int pageSize)
+{
+  return (pageSize - sizeof(PageId)) / (sizeof(PageId) + sizeof(int));
+}
+
 /**
  * BTLeafNode: The class representing a B+tree leaf node.
  */
 class BTLeafNode {
   public:
-    // constructor, fills buffer with 0s
-    BTLeafNode();
+    // constructor, fills buffer with 0xFFs for a node of pageSize bytes
+    BTLeafNode(int pageSize = PageFile::PAGE_SIZE);
 
    /**
     * Insert the (key, rid) pair to the node.
@@ -90,15 +110,29 @@ class BTLeafNode {
     int getKeyCount();
  
    /**
-    * Read the content of the node from the page pid in the PageFile pf.
+    * Make the node a read-only view of the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool and is not copied, so the
+    * node must not be modified after this call.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Make the node a writable view of the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool and changes to the node
+    * are made directly in the pinned page.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readForWrite(PageId pid, PageFile& pf);
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * If the node is a writable view of that page, nothing is copied.
+    * The page size of pf must match the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
@@ -110,10 +144,26 @@ class BTLeafNode {
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. Points to storage for a node built in
+    * memory, or to the pinned page held by page after read().
+    */
+    char* buffer;
+
+   /**
+    * The main memory buffer for a node that is not a view of a page.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    char storage[PageFile::MAX_PAGE_SIZE];
+
+   /**
+    * The size of the page the node is stored in. read() takes it from the
+    * PageFile, and write() only accepts a PageFile with the same page size.
+    */
+    int pageSize;
+
+   /**
+    * The pinned page the node is a view of, if any.
+    */
+    PageHandle page;
 }; 
 
 
@@ -122,7 +172,8 @@ class BTLeafNode {
  */
 class BTNonLeafNode {
   public:
-    BTNonLeafNode();
+    // constructor, fills buffer with 0xFFs for a node of pageSize bytes
+    BTNonLeafNode(int pageSize = PageFile::PAGE_SIZE);
    /**
     * Insert a (key, pid) pair to the node.
     * Remember that all keys inside a B+tree node should be kept sorted.
@@ -165,6 +216,21 @@ class BTNonLeafNode {
     */
     RC initializeRoot(PageId pid1, int key, PageId pid2);
 
+   /**
+    * Return the i'th child-node pointer. The node has getKeyCount()+1 of them.
+    * @param i[IN] the number of the pointer, from 0 to getKeyCount()
+    * @return the PageId of the child node
+    */
+    PageId getChildPtr(int i);
+
+   /**
+    * Replace the i'th child-node pointer.
+    * @param i[IN] the number of the pointer, from 0 to getKeyCount()
+    * @param pid[IN] the new PageId of the child node
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC setChildPtr(int i, PageId pid);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -172,15 +238,29 @@ class BTNonLeafNode {
     int getKeyCount();
 
    /**
-    * Read the content of the node from the page pid in the PageFile pf.
+    * Make the node a read-only view of the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool and is not copied, so the
+    * node must not be modified after this call.
     * @param pid[IN] the PageId to read
     * @param pf[IN] PageFile to read from
     * @return 0 if successful. Return an error code if there is an error.
     */
     RC read(PageId pid, const PageFile& pf);
+
+   /**
+    * Make the node a writable view of the page pid in the PageFile pf.
+    * The page stays pinned in the buffer pool and changes to the node
+    * are made directly in the pinned page.
+    * @param pid[IN] the PageId to read
+    * @param pf[IN] PageFile to read from
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RC readForWrite(PageId pid, PageFile& pf);
     
    /**
     * Write the content of the node to the page pid in the PageFile pf.
+    * If the node is a writable view of that page, nothing is copied.
+    * The page size of pf must match the page size of the node.
     * @param pid[IN] the PageId to write to
     * @param pf[IN] PageFile to write to
     * @return 0 if successful. Return an error code if there is an error.
@@ -190,10 +270,26 @@ class BTNonLeafNode {
 
   private:
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The content of the node. Points to storage for a node built in
+    * memory, or to the pinned page held by page after read().
+    */
+    char* buffer;
+
+   /**
+    * The main memory buffer for a node that is not a view of a page.
+    */
+    char storage[PageFile::MAX_PAGE_SIZE];
+
+   /**
+    * The size of the page the node is stored in. read() takes it from the
+    * PageFile, and write() only accepts a PageFile with the same page size.
+    */
+    int pageSize;
+
+   /**
+    * The pinned page the node is a view of, if any.
     */
-    char buffer[PageFile::PAGE_SIZE];
+    PageHandle page;
 }; 
 
 #endif /* BTREENODE_H */
@@ -11,6 +11,7 @@
 #define BRUINBASE_H
 
 typedef int RC;
+typedef int PageId;
 
 const int RC_FILE_OPEN_FAILED    = -1001;
 const int RC_FILE_CLOSE_FAILED   = -1002;
@@ -26,5 +27,8 @@ const int RC_INVALID_CURSOR      = -1011;
 const int RC_NO_SUCH_RECORD      = -1012;
 const int RC_END_OF_TREE         = -1013;
 const int RC_INVALID_ATTRIBUTE   = -1014;
+const int RC_NO_FREE_FRAME       = -1015;
+const int RC_FILE_TOO_LARGE      = -1016;
+const int RC_END_OF_FILE         = -1017;
 
 #endif // BRUINBASE_H
@@ -0,0 +1,399 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "Bruinbase.h"
+#include "BufferPool.h"
+
+using std::vector;
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+BufferPool::BufferPool(int size, int count, WriteFn fn)
+{
+  policy = LRU;
+  frameSize = size;
+  writer = fn;
+  hitCount = 0;
+  missCount = 0;
+  pthread_mutex_init(&mutex, NULL);
+  pthread_cond_init(&loaded, NULL);
+  init(count);
+}
+
+BufferPool::~BufferPool()
+{
+  release();
+  pthread_cond_destroy(&loaded);
+  pthread_mutex_destroy(&mutex);
+}
+
+RC BufferPool::resize(int count)
+{
+  RC rc;
+  if (count <= 0) return RC_INVALID_ATTRIBUTE;
+
+  // pinned pages are in use and cannot be moved
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].pinCount > 0) return RC_NO_FREE_FRAME;
+  }
+
+  // dirty pages must reach the disk before their frames go away
+  if ((rc = flush(-1)) < 0) return rc;
+
+  release();
+  init(count);
+  return 0;
+}
+
+void BufferPool::init(int count)
+{
+  frameCount = count;
+
+  // use at least twice as many buckets as frames to keep the chains short
+  for (bucketCount = 1; bucketCount < 2 * frameCount; bucketCount <<= 1);
+
+  // the cold queue of 2Q holds a quarter of the pool, and the pages
+  // evicted from it are remembered for as long as half a pool
+  coldTarget = (frameCount + 3) / 4;
+  ghostCount = (frameCount + 1) / 2;
+  ghostNext = 0;
+  clock = 0;
+
+  frames  = new Frame[frameCount];
+  buckets = new int[bucketCount];
+  ghosts  = new Ghost[ghostCount];
+  ghostBuckets = new int[bucketCount];
+
+  // the page data is aligned so that frames can be read and written
+  // with O_DIRECT
+  void* mem;
+  if (posix_memalign(&mem, ALIGNMENT, (size_t)frameCount * frameSize) != 0) throw std::bad_alloc();
+  buffer = (char*)mem;
+
+  for (int i = 0; i < bucketCount; i++) buckets[i] = ghostBuckets[i] = -1;
+  for (int i = 0; i < ghostCount; i++) ghosts[i].file = -1;
+
+  // initially every frame is free and linked into the cold queue,
+  // so free frames are handed out before anything is evicted
+  for (int q = COLD; q <= HOT; q++) {
+    head[q] = tail[q] = -1;
+    length[q] = 0;
+  }
+  for (int i = 0; i < frameCount; i++) {
+    frames[i].file = -1;
+    frames[i].pid = -1;
+    frames[i].dirty = false;
+    frames[i].pinCount = 0;
+    frames[i].hashNext = -1;
+    frames[i].loading = false;
+    frames[i].admitted = 0;
+    appendQueue(i, COLD);
+  }
+}
+
+void BufferPool::release()
+{
+  delete [] frames;
+  delete [] buckets;
+  free(buffer);
+  delete [] ghosts;
+  delete [] ghostBuckets;
+  frames = 0;
+  buckets = 0;
+  buffer = 0;
+  ghosts = 0;
+  ghostBuckets = 0;
+}
+
+int BufferPool::bucketOf(int file, PageId pid) const
+{
+  unsigned h = (unsigned)pid * 2654435761u ^ (unsigned)file * 40503u;
+  return (int)(h & (bucketCount - 1));
+}
+
+int BufferPool::find(int file, PageId pid) const
+{
+  for (int i = buckets[bucketOf(file, pid)]; i >= 0; i = frames[i].hashNext) {
+    if (frames[i].file == file && frames[i].pid == pid) return i;
+  }
+  return -1;
+}
+
+int BufferPool::findLoaded(int file, PageId pid)
+{
+  int i;
+  while ((i = find(file, pid)) >= 0 && frames[i].loading) waitLoading();
+  return i;
+}
+
+int BufferPool::lookup(int file, PageId pid)
+{
+  int i = find(file, pid);
+  if (i < 0) {
+    missCount++;
+    return -1;
+  }
+
+  touch(i);
+  hitCount++;
+  return i;
+}
+
+void BufferPool::touch(int frame)
+{
+  Frame& f = frames[frame];
+  clock++;
+
+  // the first use of a page read ahead is the one that brings it in
+  if (f.admitted == 0) f.admitted = clock;
+
+  // under 2Q, a page stays in the cold queue until it is used again
+  // after the accesses that brought it into the pool are over
+  if (policy == TWO_Q && f.queue == COLD && clock - f.admitted <= CORRELATED_PERIOD) return;
+
+  // move the frame to the most-recently-used end of the hot queue
+  unlinkQueue(frame);
+  appendQueue(frame, HOT);
+}
+
+RC BufferPool::allocate(int file, PageId pid, int& frame, bool readAhead)
+{
+  RC rc;
+
+  int i = victim();
+  if (i < 0) return RC_NO_FREE_FRAME;
+
+  if (frames[i].dirty && (rc = writeRun(i)) < 0) return rc;
+  if (frames[i].file >= 0) {
+    if (policy == TWO_Q && frames[i].queue == COLD) addGhost(frames[i].file, frames[i].pid);
+    unlinkHash(i);
+  }
+
+  frames[i].file = file;
+  frames[i].pid = pid;
+  frames[i].dirty = false;
+
+  int b = bucketOf(file, pid);
+  frames[i].hashNext = buckets[b];
+  buckets[b] = i;
+
+  // a new page enters the cold queue under 2Q, unless it was evicted
+  // from there recently; then it is used often enough to be hot
+  clock++;
+  frames[i].admitted = readAhead ? 0 : clock;
+  unlinkQueue(i);
+  if (policy == TWO_Q && !removeGhost(file, pid)) {
+    appendQueue(i, COLD);
+  } else {
+    appendQueue(i, HOT);
+  }
+
+  frame = i;
+  return 0;
+}
+
+int BufferPool::victim() const
+{
+  int i;
+
+  // use a free frame if there is one
+  if ((i = head[COLD]) >= 0 && frames[i].file < 0 && frames[i].pinCount == 0) return i;
+
+  // 2Q keeps the cold queue at its target length, taking from the hot
+  // queue only when the cold one is short. LRU finds nothing in COLD.
+  if (policy == TWO_Q && length[COLD] <= coldTarget) {
+    if ((i = firstUnpinned(HOT)) >= 0) return i;
+    return firstUnpinned(COLD);
+  }
+
+  if ((i = firstUnpinned(COLD)) >= 0) return i;
+  return firstUnpinned(HOT);
+}
+
+int BufferPool::firstUnpinned(int queue) const
+{
+  int i = head[queue];
+  while (i >= 0 && frames[i].pinCount > 0) i = frames[i].queueNext;
+  return i;
+}
+
+void BufferPool::addGhost(int file, PageId pid)
+{
+  // the oldest ghost in the ring is forgotten
+  Ghost& g = ghosts[ghostNext];
+  if (g.file >= 0) removeGhost(g.file, g.pid);
+
+  int b = bucketOf(file, pid);
+  g.file = file;
+  g.pid = pid;
+  g.hashNext = ghostBuckets[b];
+  ghostBuckets[b] = ghostNext;
+
+  ghostNext = (ghostNext + 1) % ghostCount;
+}
+
+bool BufferPool::removeGhost(int file, PageId pid)
+{
+  for (int* link = &ghostBuckets[bucketOf(file, pid)]; *link >= 0; link = &ghosts[*link].hashNext) {
+    Ghost& g = ghosts[*link];
+    if (g.file == file && g.pid == pid) {
+      *link = g.hashNext;
+      g.file = -1;
+      return true;
+    }
+  }
+  return false;
+}
+
+void BufferPool::doneLoading(int frame)
+{
+  frames[frame].loading = false;
+  pthread_cond_broadcast(&loaded);
+}
+
+RC BufferPool::flush(int file)
+{
+  RC rc;
+  vector<int> dirty;
+
+  // collect the dirty frames and sort them in the file order
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].dirty && (file < 0 || frames[i].file == file)) {
+      dirty.push_back(i);
+    }
+  }
+  std::sort(dirty.begin(), dirty.end(), FileOrder(frames));
+
+  // write each run of consecutive pages with a single call
+  unsigned start = 0;
+  for (unsigned i = 1; i <= dirty.size(); i++) {
+    if (i == dirty.size() ||
+        frames[dirty[i]].file != frames[dirty[start]].file ||
+        frames[dirty[i]].pid != frames[dirty[i-1]].pid + 1) {
+      if ((rc = writeFrames(&dirty[start], i - start)) < 0) return rc;
+      start = i;
+    }
+  }
+
+  return 0;
+}
+
+RC BufferPool::writeRun(int frame)
+{
+  int    file = frames[frame].file;
+  PageId first = frames[frame].pid;
+  PageId last = first;
+  int    i;
+
+  // extend the run in both directions over cached dirty pages
+  while ((i = find(file, first - 1)) >= 0 && frames[i].dirty) first--;
+  while ((i = find(file, last + 1)) >= 0 && frames[i].dirty) last++;
+
+  vector<int> run;
+  for (PageId pid = first; pid <= last; pid++) run.push_back(find(file, pid));
+
+  return writeFrames(&run[0], run.size());
+}
+
+RC BufferPool::writeFrames(const int* frameList, int count)
+{
+  RC rc;
+  struct iovec iov[IOV_MAX];
+
+  for (int done = 0; done < count; ) {
+    int n = std::min(count - done, IOV_MAX);
+    for (int k = 0; k < n; k++) {
+      iov[k].iov_base = data(frameList[done + k]);
+      iov[k].iov_len = frameSize;
+    }
+
+    const Frame& f = frames[frameList[done]];
+    if ((rc = writer(f.file, f.pid, iov, n)) < 0) return rc;
+
+    for (int k = 0; k < n; k++) frames[frameList[done + k]].dirty = false;
+    done += n;
+  }
+
+  return 0;
+}
+
+void BufferPool::invalidate(int file, PageId pid)
+{
+  for (int i = buckets[bucketOf(file, pid)]; i >= 0; i = frames[i].hashNext) {
+    if (frames[i].file == file && frames[i].pid == pid) {
+      if (frames[i].pinCount > 0) return;
+      unlinkHash(i);
+      frames[i].file = -1;
+      frames[i].pid = -1;
+      frames[i].dirty = false;
+
+      // a free frame should be the next one to be reused
+      unlinkQueue(i);
+      prependQueue(i, COLD);
+      return;
+    }
+  }
+}
+
+void BufferPool::invalidateFile(int file)
+{
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].file == file) invalidate(file, frames[i].pid);
+  }
+}
+
+void BufferPool::getPages(vector<int>& files, vector<PageId>& pids) const
+{
+  for (int i = 0; i < frameCount; i++) {
+    if (frames[i].file < 0 || frames[i].loading) continue;
+    files.push_back(frames[i].file);
+    pids.push_back(frames[i].pid);
+  }
+}
+
+void BufferPool::unlinkHash(int frame)
+{
+  int* link = &buckets[bucketOf(frames[frame].file, frames[frame].pid)];
+  while (*link != frame) link = &frames[*link].hashNext;
+  *link = frames[frame].hashNext;
+  frames[frame].hashNext = -1;
+}
+
+void BufferPool::unlinkQueue(int frame)
+{
+  Frame& f = frames[frame];
+  int q = f.queue;
+  if (f.queuePrev >= 0) frames[f.queuePrev].queueNext = f.queueNext; else head[q] = f.queueNext;
+  if (f.queueNext >= 0) frames[f.queueNext].queuePrev = f.queuePrev; else tail[q] = f.queuePrev;
+  length[q]--;
+}
+
+void BufferPool::appendQueue(int frame, int queue)
+{
+  frames[frame].queue = queue;
+  frames[frame].queuePrev = tail[queue];
+  frames[frame].queueNext = -1;
+  if (tail[queue] >= 0) frames[tail[queue]].queueNext = frame; else head[queue] = frame;
+  tail[queue] = frame;
+  length[queue]++;
+}
+
+void BufferPool::prependQueue(int frame, int queue)
+{
+  frames[frame].queue = queue;
+  frames[frame].queuePrev = -1;
+  frames[frame].queueNext = head[queue];
+  if (head[queue] >= 0) frames[head[queue]].queuePrev = frame; else tail[queue] = frame;
+  head[queue] = frame;
+  length[queue]++;
+}
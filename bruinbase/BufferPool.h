@@ -0,0 +1,321 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <pthread.h>
+#include <sys/uio.h>
+#include <vector>
+#include "Bruinbase.h"
+
+/**
+ * a fixed-capacity pool of page frames. PageFile caches the pages of all
+ * files in a few of these.
+ * frames are found through a hash table keyed by (file, pid), so
+ * lookup is O(1). the replacement policy is either plain LRU or 2Q:
+ *
+ *  - LRU evicts the least recently used page. a single sequential scan
+ *    larger than the pool evicts every other page.
+ *  - 2Q admits a new page to a small FIFO queue ("cold"), and moves it to
+ *    the LRU queue of frequently used pages ("hot") only when it is used
+ *    again later. pages evicted from the cold queue are remembered for a
+ *    while, and are admitted straight to the hot queue if they come back.
+ *    pages read once by a scan only pass through the cold queue, so the
+ *    upper levels of B+trees in the hot queue survive the scan.
+ *
+ * the pool is write-back: a written page is only marked dirty, and it is
+ * written to disk when it is evicted or when its file is flushed.
+ * dirty pages that are adjacent in the file are written with one call.
+ *
+ * a pool is shared by threads through its mutex. the methods do not lock
+ * it themselves: the caller holds lock() around every sequence of calls
+ * that must see a consistent pool. a frame whose page is being read from
+ * the disk is pinned and marked as loading, so that the read can happen
+ * without holding the lock; other threads wait for it with waitLoading().
+ */
+class BufferPool {
+ public:
+
+  static const int DEFAULT_SIZE_MB = 4;  // default capacity of the pool
+  static const int ALIGNMENT = 4096;     // the alignment of the frame buffer
+
+  /**
+   * the page replacement policies
+   */
+  enum Policy { LRU, TWO_Q };
+
+  /**
+   * the function used to write dirty pages back to their file.
+   * the pages pid, pid+1, ..., pid+count-1 are stored in iov[0..count-1].
+   * @return error code. 0 if no error
+   */
+  typedef RC (*WriteFn)(int file, PageId pid, const struct iovec* iov, int count);
+
+  /**
+   * create a pool holding frameCount frames of frameSize bytes each.
+   * @param frameSize[IN] the size of a frame in bytes
+   * @param frameCount[IN] the number of frames in the pool
+   * @param writer[IN] the function that writes dirty pages to disk
+   */
+  BufferPool(int frameSize, int frameCount, WriteFn writer);
+  ~BufferPool();
+
+  /**
+   * acquire and release the mutex of the pool.
+   */
+  void lock()   { pthread_mutex_lock(&mutex); }
+  void unlock() { pthread_mutex_unlock(&mutex); }
+
+  /**
+   * change the page replacement policy. cached pages are kept.
+   * @param policy[IN] the new policy
+   */
+  void setPolicy(Policy policy) { this->policy = policy; }
+  Policy getPolicy() const { return policy; }
+
+  /**
+   * write back all dirty pages, drop every cached page and reallocate
+   * the pool with a new capacity. fails if any frame is pinned.
+   * @param frameCount[IN] the new number of frames. must be positive
+   * @return error code. 0 if no error
+   */
+  RC resize(int frameCount);
+
+  /**
+   * look up a page in the pool. if found, the frame is touched and the
+   * hit counter is incremented; otherwise the miss counter is incremented.
+   * @param file[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to look up
+   * @return the frame number of the page, or -1 if it is not cached
+   */
+  int lookup(int file, PageId pid);
+
+  /**
+   * find a page like find(), but if the page is being read from the disk
+   * by another thread, wait until it is loaded. the lock must be held.
+   * @param file[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to find
+   * @return the frame number of the page, or -1 if it is not cached
+   */
+  int findLoaded(int file, PageId pid);
+
+  /**
+   * find a page in the pool without updating the LRU order or the counters.
+   * @param file[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to find
+   * @return the frame number of the page, or -1 if it is not cached
+   */
+  int find(int file, PageId pid) const;
+
+  /**
+   * record a use of the page in a frame. under LRU the frame becomes the
+   * most recently used one. under 2Q a page in the cold queue moves to the
+   * hot queue, unless the use closely follows the one that brought the
+   * page into the pool (e.g. reading the next record of the same page).
+   * @param frame[IN] the frame number
+   */
+  void touch(int frame);
+
+  /**
+   * assign a frame to a page that is not in the pool yet, evicting an
+   * unpinned page chosen by the replacement policy if no frame is free.
+   * if the evicted page is dirty, it is written back first.
+   * the content of the assigned frame is undefined.
+   * @param file[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to cache
+   * @param frame[OUT] the frame number assigned to the page
+   * @param readAhead[IN] true if the page is read before it is needed.
+   *        its first touch() then counts as the use that brought it in.
+   * @return error code. RC_NO_FREE_FRAME if every frame is pinned
+   */
+  RC allocate(int file, PageId pid, int& frame, bool readAhead = false);
+
+  /**
+   * pin a frame so that it is not evicted until it is unpinned.
+   * a frame may be pinned several times; it stays pinned until
+   * unpin() has been called as many times.
+   * @param frame[IN] the frame number
+   */
+  void pin(int frame)   { frames[frame].pinCount++; }
+
+  /**
+   * release one pin of a frame.
+   * @param frame[IN] the frame number
+   */
+  void unpin(int frame) { frames[frame].pinCount--; }
+
+  /**
+   * mark a frame as being filled from the disk. the caller pins the frame
+   * first and calls doneLoading() once the page has been read.
+   * @param frame[IN] the frame number
+   */
+  void setLoading(int frame) { frames[frame].loading = true; }
+
+  /**
+   * clear the loading mark of a frame and wake up the threads waiting for it.
+   * @param frame[IN] the frame number
+   */
+  void doneLoading(int frame);
+
+  /**
+   * @return true if the page of a frame is still being read from the disk
+   */
+  bool isLoading(int frame) const { return frames[frame].loading; }
+
+  /**
+   * release the lock until some frame is done loading, then reacquire it.
+   */
+  void waitLoading() { pthread_cond_wait(&loaded, &mutex); }
+
+  /**
+   * mark a frame as modified so that it is written back before eviction.
+   * @param frame[IN] the frame number
+   */
+  void markDirty(int frame) { frames[frame].dirty = true; }
+
+  /**
+   * write back the dirty pages of a file, coalescing adjacent pages.
+   * the pages stay in the pool.
+   * @param file[IN] the id of the file to flush. -1 flushes all files
+   * @return error code. 0 if no error
+   */
+  RC flush(int file);
+
+  /**
+   * remove a page from the pool if it is cached and not pinned.
+   * a dirty page is discarded without being written.
+   * @param file[IN] the id of the file the page belongs to
+   * @param pid[IN] the page to remove
+   */
+  void invalidate(int file, PageId pid);
+
+  /**
+   * remove all unpinned pages of a file from the pool.
+   * dirty pages are discarded without being written.
+   * @param file[IN] the id of the file whose pages are removed
+   */
+  void invalidateFile(int file);
+
+  /**
+   * list the pages cached in the pool. pages still being read from the
+   * disk are left out. the pages are appended to the two lists.
+   * @param files[OUT] the file id of each cached page
+   * @param pids[OUT] the page id of each cached page
+   */
+  void getPages(std::vector<int>& files, std::vector<PageId>& pids) const;
+
+  /**
+   * @param frame[IN] the frame number
+   * @return pointer to the page data stored in the frame
+   */
+  char* data(int frame) { return buffer + (long)frame * frameSize; }
+
+  int getFrameSize() const  { return frameSize; }
+  int getFrameCount() const { return frameCount; }
+  int getHitCount() const   { return hitCount; }
+  int getMissCount() const  { return missCount; }
+
+ private:
+  // the queues frames are kept in. free frames are at the head of COLD.
+  // under LRU, pages are only kept in HOT.
+  enum { COLD, HOT };
+
+  // a use of a page within this many uses of any page after it entered
+  // the pool is considered part of the same access and does not make the
+  // page hot
+  static const unsigned CORRELATED_PERIOD = 64;
+
+  // frames are linked into hash chains and into the doubly-linked queues
+  // through the following per-frame links. -1 is the null link.
+  struct Frame {
+    int    file;      // file id of the cached page (-1 if the frame is free)
+    PageId pid;       // page id of the cached page
+    bool   dirty;     // true if the page was modified since it was read
+    int    pinCount;  // # outstanding pins. a pinned frame is never evicted
+    int    hashNext;  // next frame in the same hash bucket
+    int    queue;     // COLD or HOT
+    int    queuePrev; // the frame before this one in its queue
+    int    queueNext; // the frame after this one in its queue
+    bool   loading;   // true while the page is being read from the disk
+    unsigned admitted; // the value of clock at the first use of the page
+                       //   (0 if it was read ahead and not used yet)
+  };
+
+  // a page recently evicted from the cold queue (2Q only)
+  struct Ghost {
+    int    file;      // file id of the page (-1 if the entry is unused)
+    PageId pid;       // page id of the page
+    int    hashNext;  // next ghost in the same hash bucket
+  };
+
+  Policy policy;      // the replacement policy
+
+  int    frameSize;   // size of each frame in bytes
+  int    frameCount;  // number of frames in the pool
+  int    bucketCount; // number of hash buckets (a power of two)
+
+  Frame* frames;      // frame descriptors
+  int*   buckets;     // heads of the hash chains
+  char*  buffer;      // frameCount * frameSize bytes of page data
+
+  int    head[2];     // the frame evicted first from each queue
+  int    tail[2];     // the frame added last to each queue
+  int    length[2];   // # frames in each queue
+  int    coldTarget;  // the cold queue is shrunk before the hot one above this
+
+  Ghost* ghosts;      // ring of the pages last evicted from the cold queue
+  int*   ghostBuckets; // heads of the hash chains of ghosts
+  int    ghostCount;  // # entries in the ring
+  int    ghostNext;   // the entry of the ring overwritten next
+
+  unsigned clock;     // # page uses so far
+
+  int    hitCount;    // # lookups that found the page
+  int    missCount;   // # lookups that did not find the page
+
+  WriteFn writer;     // writes dirty pages back to disk
+
+  pthread_mutex_t mutex;  // protects everything above
+  pthread_cond_t  loaded; // signaled when a frame is done loading
+
+  // orders frame numbers by the (file, pid) of the page they hold
+  struct FileOrder {
+    const Frame* frames;
+    FileOrder(const Frame* f) : frames(f) {}
+    bool operator() (int a, int b) const {
+      if (frames[a].file != frames[b].file) return frames[a].file < frames[b].file;
+      return frames[a].pid < frames[b].pid;
+    }
+  };
+
+  void init(int frameCount);
+  void release();
+
+  // write back the run of adjacent dirty pages that contains frame
+  RC writeRun(int frame);
+
+  // write back count dirty frames holding consecutive pages of one file
+  RC writeFrames(const int* frameList, int count);
+
+  // pick the unpinned frame to reuse for a new page, -1 if none
+  int  victim() const;
+
+  // the first unpinned frame of a queue, -1 if none
+  int  firstUnpinned(int queue) const;
+
+  // remember a page evicted from the cold queue, and forget it again
+  void addGhost(int file, PageId pid);
+  bool removeGhost(int file, PageId pid);
+
+  int  bucketOf(int file, PageId pid) const;
+  void unlinkHash(int frame);
+  void unlinkQueue(int frame);
+  void appendQueue(int frame, int queue);
+  void prependQueue(int frame, int queue);
+};
+
+#endif // BUFFERPOOL_H
@@ -0,0 +1,137 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "IOStats.h"
+#include <cstring>
+#include <time.h>
+
+void IOStats::clear()
+{
+  hits = misses = 0;
+  pagesRead = pagesWritten = 0;
+  bytesRead = bytesWritten = 0;
+  reads = 0;
+  memset(latency, 0, sizeof(latency));
+}
+
+void IOStats::countRead(int pages, long long bytes, long long usec)
+{
+  // find the bucket: the smallest i with usec < 2^i
+  int bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && usec >= (1LL << bucket)) bucket++;
+
+  __atomic_fetch_add(&pagesRead, pages, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&bytesRead, bytes, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&reads, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&latency[bucket], 1, __ATOMIC_RELAXED);
+}
+
+void IOStats::countWrite(int pages, long long bytes)
+{
+  __atomic_fetch_add(&pagesWritten, pages, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&bytesWritten, bytes, __ATOMIC_RELAXED);
+}
+
+IOStats IOStats::snapshot() const
+{
+  IOStats s;
+  s.hits = __atomic_load_n(&hits, __ATOMIC_RELAXED);
+  s.misses = __atomic_load_n(&misses, __ATOMIC_RELAXED);
+  s.pagesRead = __atomic_load_n(&pagesRead, __ATOMIC_RELAXED);
+  s.pagesWritten = __atomic_load_n(&pagesWritten, __ATOMIC_RELAXED);
+  s.bytesRead = __atomic_load_n(&bytesRead, __ATOMIC_RELAXED);
+  s.bytesWritten = __atomic_load_n(&bytesWritten, __ATOMIC_RELAXED);
+  s.reads = __atomic_load_n(&reads, __ATOMIC_RELAXED);
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    s.latency[i] = __atomic_load_n(&latency[i], __ATOMIC_RELAXED);
+  }
+  return s;
+}
+
+void IOStats::subtract(const IOStats& before)
+{
+  hits -= before.hits;
+  misses -= before.misses;
+  pagesRead -= before.pagesRead;
+  pagesWritten -= before.pagesWritten;
+  bytesRead -= before.bytesRead;
+  bytesWritten -= before.bytesWritten;
+  reads -= before.reads;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) latency[i] -= before.latency[i];
+}
+
+void IOStats::add(const IOStats& other)
+{
+  hits += other.hits;
+  misses += other.misses;
+  pagesRead += other.pagesRead;
+  pagesWritten += other.pagesWritten;
+  bytesRead += other.bytesRead;
+  bytesWritten += other.bytesWritten;
+  reads += other.reads;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) latency[i] += other.latency[i];
+}
+
+long long IOStats::percentile(double p) const
+{
+  if (reads <= 0) return 0;
+
+  // walk the buckets until the fraction p of the reads is covered
+  long long target = (long long)(p * reads + 0.5);
+  if (target < 1) target = 1;
+  long long seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += latency[i];
+    if (seen >= target) return 1LL << i;
+  }
+  return 1LL << (LATENCY_BUCKETS - 1);
+}
+
+void IOStats::printHeader(FILE* out)
+{
+  fprintf(out, "%-16s %10s %10s %10s %10s %12s %12s %8s %8s\n",
+          "file", "hits", "misses", "pg_read", "pg_write",
+          "kb_read", "kb_write", "p50_us", "p99_us");
+}
+
+void IOStats::print(FILE* out, const char* name) const
+{
+  fprintf(out, "%-16s %10lld %10lld %10lld %10lld %12lld %12lld %8lld %8lld\n",
+          name, hits, misses, pagesRead, pagesWritten,
+          bytesRead / 1024, bytesWritten / 1024,
+          percentile(0.5), percentile(0.99));
+}
+
+void IOStats::printJSON(FILE* out, const char* name) const
+{
+  // file names are printed as they are, except for quotes and backslashes
+  fputs("{\"file\":\"", out);
+  for (const char* c = name; *c; c++) {
+    if (*c == '"' || *c == '\\') fputc('\\', out);
+    fputc(*c, out);
+  }
+  fprintf(out, "\",\"hits\":%lld,\"misses\":%lld,\"pages_read\":%lld,"
+          "\"pages_written\":%lld,\"bytes_read\":%lld,\"bytes_written\":%lld,"
+          "\"reads\":%lld,\"read_latency_us\":[",
+          hits, misses, pagesRead, pagesWritten, bytesRead, bytesWritten, reads);
+
+  // the histogram as [upper bound, count] pairs of the non-empty buckets
+  bool first = true;
+  for (int i = 0; i < LATENCY_BUCKETS; i++) {
+    if (latency[i] == 0) continue;
+    fprintf(out, "%s[%lld,%lld]", first ? "" : ",", 1LL << i, latency[i]);
+    first = false;
+  }
+  fputs("]}", out);
+}
+
+long long IOStats::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
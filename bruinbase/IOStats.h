@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef IOSTATS_H
+#define IOSTATS_H
+
+#include <cstdio>
+#include "Bruinbase.h"
+
+/**
+ * I/O counters of a file: buffer pool hits and misses, pages and bytes
+ * transferred, and a histogram of how long the disk reads took.
+ * the count functions may be called by several threads at once; they
+ * update the counters atomically.
+ */
+class IOStats {
+ public:
+  // bucket i of the latency histogram counts the reads that took less
+  // than 2^i microseconds (and at least 2^(i-1)). the last bucket counts
+  // all reads slower than that.
+  static const int LATENCY_BUCKETS = 20;
+
+  long long hits;          // # page reads served from the buffer pool
+  long long misses;        // # page reads that missed the buffer pool
+  long long pagesRead;     // # pages read from the disk
+  long long pagesWritten;  // # pages written to the disk
+  long long bytesRead;     // # bytes read from the disk
+  long long bytesWritten;  // # bytes written to the disk
+  long long reads;         // # disk reads (one read may cover many pages)
+  long long latency[LATENCY_BUCKETS]; // histogram of the read latencies
+
+  IOStats() { clear(); }
+
+  /**
+   * reset all counters to zero.
+   */
+  void clear();
+
+  void countHit()  { __atomic_fetch_add(&hits, 1, __ATOMIC_RELAXED); }
+  void countMiss() { __atomic_fetch_add(&misses, 1, __ATOMIC_RELAXED); }
+
+  /**
+   * count one disk read.
+   * @param pages[IN] # pages read
+   * @param bytes[IN] # bytes read
+   * @param usec[IN] how long the read took in microseconds
+   */
+  void countRead(int pages, long long bytes, long long usec);
+
+  /**
+   * count one disk write.
+   * @param pages[IN] # pages written
+   * @param bytes[IN] # bytes written
+   */
+  void countWrite(int pages, long long bytes);
+
+  /**
+   * @return a copy of the counters, read atomically one by one
+   */
+  IOStats snapshot() const;
+
+  /**
+   * subtract the counters of an earlier snapshot, leaving what happened since.
+   */
+  void subtract(const IOStats& before);
+
+  /**
+   * add the counters of another file.
+   */
+  void add(const IOStats& other);
+
+  /**
+   * @return the latency in microseconds below which the fraction p of the
+   *         reads completed (the upper bound of the histogram bucket).
+   *         0 if there was no read.
+   */
+  long long percentile(double p) const;
+
+  /**
+   * print the column names of print().
+   */
+  static void printHeader(FILE* out);
+
+  /**
+   * print the counters as one row of a table.
+   * @param name[IN] the name of the file the counters belong to
+   */
+  void print(FILE* out, const char* name) const;
+
+  /**
+   * print the counters as a JSON object.
+   * @param name[IN] the name of the file the counters belong to
+   */
+  void printJSON(FILE* out, const char* name) const;
+
+  /**
+   * @return the current time in microseconds, to time reads with
+   */
+  static long long now();
+};
+
+#endif // IOSTATS_H
@@ -9,172 +9,1039 @@
 
 #include "Bruinbase.h"
 #include "PageFile.h"
+#include "AsyncIO.h"
+#include "PageTrace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
-#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#include <vector>
 
 using std::string;
+using std::vector;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+// page offsets are computed in off_t. on 32-bit systems that needs
+// large file support (-D_FILE_OFFSET_BITS=64, see the Makefile).
+static_assert(sizeof(off_t) >= 8, "PageFile needs 64-bit file offsets");
+
+// the files assigned buffer pool ids so far.
+// the id of a file is its index in this list.
+struct FileEntry {
+  dev_t dev;      // device of the file
+  ino_t ino;      // inode of the file
+  vector<StorageBackend*> writers; // the storages of the file open in
+                                   //   'w' mode. dirty pages are written
+                                   //   back through the first of them
+  off_t base;     // the offset of page 0 in the file
+  int   pageSize; // the page size of the file
+  string name;    // the name the file was last opened with
+  IOStats* stats; // the I/O counters of the file. never freed, so that
+                  //   PageFiles can update them without the lock
+};
+static vector<FileEntry> fileIds;
+static pthread_mutex_t fileLock = PTHREAD_MUTEX_INITIALIZER;  // protects fileIds
+
+// protects the creation of buffer pools
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the warm-up thread, valid while warming is true
+static pthread_t warmThread;
+static bool warming = false;
+
+// a page listed by saveCachedPages(): the name of its file and its pid
+typedef std::pair<string, PageId> CachedPage;
+
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+int PageFile::defaultPageSize = PageFile::PAGE_SIZE;
+bool PageFile::directIO = false;
+int PageFile::cacheSizeMB = BufferPool::DEFAULT_SIZE_MB;
+BufferPool::Policy PageFile::policy = BufferPool::TWO_Q;
+BufferPool* PageFile::pools[PageFile::POOL_COUNT][PageFile::SHARD_COUNT];
 
 PageFile::PageFile() 
 { 
-  fd = -1; 
+  store = 0;
+  fid = -1;
   epid = 0; 
+  pageSize = PAGE_SIZE;
+  headerPages = 0;
+  writable = false;
+  map = 0;
+  mapSize = 0;
+  shards = 0;
+  sequential = false;
+  direct = false;
+  freeHead = -1;
+  freeCount = 0;
+  headerDirty = false;
+  stats = 0;
+  lastPid = -1;
+  seqCount = 0;
 }
 
 PageFile::PageFile(const string& filename, char mode)
 {
-  fd = -1;
+  store = 0;
+  fid = -1;
   epid = 0;
+  pageSize = PAGE_SIZE;
+  headerPages = 0;
+  writable = false;
+  map = 0;
+  mapSize = 0;
+  shards = 0;
+  sequential = false;
+  direct = false;
+  freeHead = -1;
+  freeCount = 0;
+  headerDirty = false;
+  stats = 0;
+  lastPid = -1;
+  seqCount = 0;
   open(filename.c_str(), mode);
 }
 
+PageFile::~PageFile()
+{
+  if (store) close();
+}
+
 RC PageFile::open(const string& filename, char mode)
 {
-  RC   rc;
-  int  oflag;
-  struct stat statbuf;
+  RC    rc;
+  bool  write;
+  off_t size;
+  dev_t dev;
+  ino_t ino;
 
-  if (fd > 0) return RC_FILE_OPEN_FAILED;
+  if (store) return RC_FILE_OPEN_FAILED;
 
-  // set the unix file flag depending on the file mode
+  // set the storage mode depending on the file mode
   switch (mode) {
   case 'r':
   case 'R':
-    oflag = O_RDONLY;
+    write = false;
     break;
   case 'w':
   case 'W':
-    oflag = (O_RDWR|O_CREAT);
+    write = true;
+    break;
+  case 'm':
+  case 'M':
+    write = false;
     break;
   default:
     return RC_INVALID_FILE_MODE;
   }
 
   // open the file
-  fd = ::open(filename.c_str(), oflag, 0644);
-  if (fd < 0) { fd = -1; return RC_FILE_OPEN_FAILED; }
+  store = StorageBackend::create();
+  if ((rc = store->open(filename, write)) < 0) { delete store; store = 0; return rc; }
 
   // get the size of the file to set the end pid
-  rc = ::fstat(fd, &statbuf);
-  if (rc < 0) { ::close(fd); fd = -1; return RC_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
+  if ((rc = store->getSize(size)) < 0) { closeStore(); return rc; }
+
+  // find the page size of the file, creating the header of a new file
+  writable = write;
+  if ((rc = readHeader(size)) < 0) { closeStore(); return rc; }
+  off_t pages = size / pageSize - headerPages;
+  if (pages > (off_t)MAX_PID + 1) { closeStore(); return RC_FILE_TOO_LARGE; }
+  epid = (pages < 0) ? 0 : pages;
+
+  // switch to O_DIRECT now that the header has been read. page I/O only
+  // goes through the aligned frames of the buffer pool, so every transfer
+  // is aligned. if the storage refuses, the file stays buffered.
+  direct = false;
+  if (directIO && mode != 'm' && mode != 'M' && pageSize % BufferPool::ALIGNMENT == 0) {
+    direct = store->setDirect();
+  }
+  shards = poolFor(pageSize);
+
+  // dirty pages of the file are written back through this storage
+  store->getId(dev, ino);
+  pthread_mutex_lock(&fileLock);
+  fid = fileId(dev, ino);
+  fileIds[fid].base = offsetOf(0);
+  fileIds[fid].pageSize = pageSize;
+  fileIds[fid].name = filename;
+  if (writable) fileIds[fid].writers.push_back(store);
+  stats = fileIds[fid].stats;
+  pthread_mutex_unlock(&fileLock);
+
+  // pages cached for an empty file are stale; the file was recreated
+  if (epid == 0) {
+    for (int i = 0; i < SHARD_COUNT; i++) {
+      shards[i]->lock();
+      shards[i]->invalidateFile(fid);
+      shards[i]->unlock();
+    }
+  }
+
+  // in 'm' mode, map the whole file. pages of the file that are still
+  // dirty in the buffer pool are written first so that the mapping
+  // sees them. storage that cannot be mapped is read through the
+  // buffer pool instead.
+  if ((mode == 'm' || mode == 'M') && epid > 0 && store->getFd() >= 0) {
+    if ((rc = flushShards(shards, fid)) < 0) { closeStore(); return rc; }
+    mapSize = offsetOf(epid);
+    void* addr = ::mmap(0, mapSize, PROT_READ, MAP_SHARED, store->getFd(), 0);
+    if (addr == MAP_FAILED) { closeStore(); return RC_FILE_OPEN_FAILED; }
+    map = (char*)addr;
+  }
 
   return 0;
 }
 
-RC PageFile::close()
+void PageFile::closeStore()
 {
-  if (fd <= 0) return RC_FILE_CLOSE_FAILED;
+  store->close();
+  delete store;
+  store = 0;
+}
 
-  // close the file
-  if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
+RC PageFile::readHeader(off_t size)
+{
+  FileHeader header;
+
+  freeHead = -1;
+  freeCount = 0;
+
+  // a new file gets a header page recording the default page size
+  if (size == 0) {
+    pageSize = defaultPageSize;
+    headerPages = 1;
+    return writable ? writeHeader() : 0;
+  }
+
+  // an old file starts directly with page 0 of 1KB
+  if (size < (off_t)sizeof(header) ||
+      store->read(&header, sizeof(header), 0) != sizeof(header) ||
+      header.magic != FILE_MAGIC) {
+    pageSize = PAGE_SIZE;
+    headerPages = 0;
+    return 0;
+  }
+
+  if ((header.version != 1 && header.version != FILE_VERSION) ||
+      poolFor(header.pageSize) == 0) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  pageSize = header.pageSize;
+  headerPages = 1;
+  if (header.version == FILE_VERSION) {
+    freeHead = header.freeHead;
+    freeCount = header.freeCount;
+  }
+  return 0;
+}
+
+RC PageFile::writeHeader()
+{
+  FileHeader header;
+  void*      page;
+
+  // the file may be open with O_DIRECT, which needs an aligned buffer
+  if (posix_memalign(&page, BufferPool::ALIGNMENT, pageSize) != 0) return RC_FILE_WRITE_FAILED;
+  memset(page, 0, pageSize);
+  header.magic = FILE_MAGIC;
+  header.version = FILE_VERSION;
+  header.pageSize = pageSize;
+  header.freeHead = freeHead;
+  header.freeCount = freeCount;
+  memcpy(page, &header, sizeof(header));
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+  RC rc = (store->write(page, pageSize, 0) == pageSize) ? 0 : RC_FILE_WRITE_FAILED;
+  free(page);
+  if (rc == 0) headerDirty = false;
+
+  return rc;
+}
+
+BufferPool** PageFile::poolFor(int size)
+{
+  for (int i = 0; i < POOL_COUNT; i++) {
+    if ((MIN_PAGE_SIZE << i) != size) continue;
+
+    pthread_mutex_lock(&poolLock);
+    if (pools[i][0] == 0) {
+      for (int s = 0; s < SHARD_COUNT; s++) {
+        pools[i][s] = new BufferPool(size, shardFrames(size), writeBack);
+        pools[i][s]->setPolicy(policy);
+      }
     }
+    pthread_mutex_unlock(&poolLock);
+    return pools[i];
   }
 
-  // set the fd and epid to the initial state
-  fd = -1; 
-  epid = 0;
+  // not a supported page size
   return 0;
 }
 
-PageId PageFile::endPid() const 
+int PageFile::shardFrames(int size)
 {
-  return epid;
+  long count = (long)cacheSizeMB * 1024 * 1024 / size / SHARD_COUNT;
+  return std::max(count, (long)MIN_SHARD_FRAMES);
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::setDefaultPageSize(int size)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  for (int i = 0; i < POOL_COUNT; i++) {
+    if ((MIN_PAGE_SIZE << i) == size) {
+      defaultPageSize = size;
+      return 0;
+    }
+  }
+  return RC_INVALID_ATTRIBUTE;
 }
 
-RC PageFile::write(PageId pid, const void* buffer)
+int PageFile::fileId(dev_t dev, ino_t ino)
+{
+  for (unsigned i = 0; i < fileIds.size(); i++) {
+    if (fileIds[i].dev == dev && fileIds[i].ino == ino) return i;
+  }
+
+  FileEntry entry;
+  entry.dev = dev;
+  entry.ino = ino;
+  entry.base = 0;
+  entry.pageSize = PAGE_SIZE;
+  entry.stats = new IOStats;
+  fileIds.push_back(entry);
+  return fileIds.size() - 1;
+}
+
+RC PageFile::writeBack(int file, PageId pid, const struct iovec* iov, int count)
+{
+  RC rc = 0;
+
+  // the lock keeps the file from being closed during the write
+  pthread_mutex_lock(&fileLock);
+  const FileEntry& f = fileIds[file];
+  if (f.writers.empty()) {
+    rc = RC_FILE_WRITE_FAILED;
+  } else {
+    // write the whole run of pages with a single call
+    off_t offset = f.base + (off_t)pid * f.pageSize;
+    if (f.writers[0]->writev(iov, count, offset) != (ssize_t)count * f.pageSize) rc = RC_FILE_WRITE_FAILED;
+    else f.stats->countWrite(count, (long long)count * f.pageSize);
+  }
+  pthread_mutex_unlock(&fileLock);
+  if (rc < 0) return rc;
+
+  // increase page write count
+  writeCount += count;
+
+  return 0;
+}
+
+RC PageFile::flushShards(BufferPool** shards, int file)
+{
+  RC rc = 0;
+  for (int i = 0; i < SHARD_COUNT && rc == 0; i++) {
+    shards[i]->lock();
+    rc = shards[i]->flush(file);
+    shards[i]->unlock();
+  }
+  return rc;
+}
+
+RC PageFile::flush()
+{
+  if (store == 0) return RC_FILE_WRITE_FAILED;
+  if (!writable) return 0;
+  if (headerDirty && writeHeader() < 0) return RC_FILE_WRITE_FAILED;
+  return flushShards(shards, fid);
+}
+
+RC PageFile::flushAll()
 {
   RC rc;
-  if (pid < 0) return RC_INVALID_PID; 
+  for (int i = 0; i < POOL_COUNT; i++) {
+    if (pools[i][0] && (rc = flushShards(pools[i], -1)) < 0) return rc;
+  }
+  return 0;
+}
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+int PageFile::getCacheHitCount()
+{
+  int count = 0;
+  for (int i = 0; i < POOL_COUNT; i++) {
+    for (int s = 0; s < SHARD_COUNT && pools[i][s]; s++) {
+      pools[i][s]->lock();
+      count += pools[i][s]->getHitCount();
+      pools[i][s]->unlock();
+    }
+  }
+  return count;
+}
 
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+int PageFile::getCacheMissCount()
+{
+  int count = 0;
+  for (int i = 0; i < POOL_COUNT; i++) {
+    for (int s = 0; s < SHARD_COUNT && pools[i][s]; s++) {
+      pools[i][s]->lock();
+      count += pools[i][s]->getMissCount();
+      pools[i][s]->unlock();
+    }
+  }
+  return count;
+}
+
+void PageFile::getFileStats(vector<string>& names, vector<IOStats>& stats)
+{
+  names.clear();
+  stats.clear();
+
+  pthread_mutex_lock(&fileLock);
+  for (unsigned i = 0; i < fileIds.size(); i++) {
+    names.push_back(fileIds[i].name);
+    stats.push_back(fileIds[i].stats->snapshot());
+  }
+  pthread_mutex_unlock(&fileLock);
+}
+
+RC PageFile::close()
+{
+  RC rc = 0;
+  if (store == 0) return RC_FILE_CLOSE_FAILED;
 
-  // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  // write back the dirty pages of the file. if that fails, they are
+  // dropped since they cannot be written once the file is closed.
+  if (writable) {
+    if (headerDirty) rc = writeHeader();
+    if (rc == 0 && (rc = flushShards(shards, fid)) < 0) {
+      for (int i = 0; i < SHARD_COUNT; i++) {
+        shards[i]->lock();
+        shards[i]->invalidateFile(fid);
+        shards[i]->unlock();
+      }
     }
+    pthread_mutex_lock(&fileLock);
+    vector<StorageBackend*>& writers = fileIds[fid].writers;
+    writers.erase(std::find(writers.begin(), writers.end(), store));
+    pthread_mutex_unlock(&fileLock);
+  }
+
+  // unmap the file in 'm' mode
+  if (map) {
+    ::munmap(map, mapSize);
+    map = 0;
+    mapSize = 0;
+  }
+
+  // close the file
+  if (store->close() < 0) rc = RC_FILE_CLOSE_FAILED;
+  delete store;
+
+  // set the storage and epid to the initial state.
+  // the cached pages of the file stay in the pool for later use.
+  store = 0;
+  fid = -1;
+  epid = 0;
+  writable = false;
+  shards = 0;
+  sequential = false;
+  direct = false;
+  freeHead = -1;
+  freeCount = 0;
+  headerDirty = false;
+  stats = 0;
+  lastPid = -1;
+  seqCount = 0;
+  return rc;
+}
+
+PageId PageFile::endPid() const 
+{
+  return epid;
+}
+
+RC PageFile::write(PageId pid, const void* buffer)
+{
+  RC          rc;
+  int         frame;
+  BufferPool* pool;
+
+  if (pid < 0) return RC_INVALID_PID; 
+  if (pid > MAX_PID) return RC_FILE_TOO_LARGE;
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  // the page is written to its frame in the buffer pool and marked dirty.
+  // it reaches the disk when it is evicted or when the file is flushed.
+  pool = shardOf(pid);
+  pool->lock();
+  frame = pool->findLoaded(fid, pid);
+  if (frame >= 0) {
+    pool->touch(frame);
+  } else if ((rc = pool->allocate(fid, pid, frame)) < 0) {
+    pool->unlock();
+    return rc;
   }
+  if (pool->data(frame) != buffer) memcpy(pool->data(frame), buffer, pageSize);
+  pool->markDirty(frame);
+  pool->unlock();
 
   // if the written pid >= end pid, update the end pid
   if (pid >= epid) epid = pid + 1;
 
-  // increase page write count
-  writeCount++;
-
+  PageTrace::record(fid, pid, PageTrace::WRITE, pageSize);
   return 0;
 }
 
-RC PageFile::read(PageId pid, void* buffer) const
+RC PageFile::fetch(PageId pid, BufferPool*& pool, int& frame) const
 {
   RC rc;
 
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
+  // keep track of how many pages have been read in order. reading the
+  // same page again (an index scan reads a leaf once per entry) does not
+  // break the sequence.
+  if (pid != lastPid) seqCount = (pid == lastPid + 1) ? seqCount + 1 : 0;
+  lastPid = pid;
+
   //
-  // if the page is in cache, read it from there
+  // if the page is in the buffer pool, use it from there.
+  // if another thread is reading it from the disk, wait for that read.
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
-    }
-  }
-
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
-    }
-  }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
-    return RC_FILE_READ_FAILED;
+  pool = shardOf(pid);
+  pool->lock();
+  pool->findLoaded(fid, pid);
+  if ((frame = pool->lookup(fid, pid)) >= 0) {
+    pool->pin(frame);
+    pool->unlock();
+    stats->countHit();
+    return 0;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  stats->countMiss();
+
+  // in a sequential scan, read the following pages as well
+  if (sequential || seqCount >= SEQ_THRESHOLD) return readAhead(pid, pool, frame);
+
+  // assign a frame to the page. the page is read into the frame without
+  // holding the lock; other threads wait until it is loaded.
+  if ((rc = pool->allocate(fid, pid, frame)) < 0) {
+    pool->unlock();
+    return rc;
+  }
+  pool->pin(frame);
+  pool->setLoading(frame);
+  pool->unlock();
+
+  long long start = IOStats::now();
+  bool failed = store->read(pool->data(frame), pageSize, offsetOf(pid)) < 0;
+  if (!failed) stats->countRead(1, pageSize, IOStats::now() - start);
+
+  pool->lock();
+  pool->doneLoading(frame);
+  if (failed) {
+    pool->unpin(frame);
+    pool->invalidate(fid, pid);
+  }
+  pool->unlock();
+  if (failed) return RC_FILE_READ_FAILED;
 
   // increase the page read count
   readCount++;
 
   return 0;
 }
+
+RC PageFile::readAhead(PageId pid, BufferPool* pool, int& frame) const
+{
+  int frames[READ_AHEAD_SIZE / MIN_PAGE_SIZE];
+  struct iovec iov[READ_AHEAD_SIZE / MIN_PAGE_SIZE];
+  int n;
+
+  // assign frames to the page and to the uncached pages that follow it
+  // in the same shard, pinning them so that the run cannot evict its own
+  // pages and marking them as loading
+  int max = std::min(READ_AHEAD_SIZE / pageSize, SHARD_PAGES - pid % SHARD_PAGES);
+  for (n = 0; n < max && pid + n < epid; n++) {
+    if (n > 0 && pool->find(fid, pid + n) >= 0) break;
+    if (pool->allocate(fid, pid + n, frames[n], n > 0) < 0) break;
+    pool->pin(frames[n]);
+    pool->setLoading(frames[n]);
+    iov[n].iov_base = pool->data(frames[n]);
+    iov[n].iov_len = pageSize;
+  }
+  if (n == 0) {
+    pool->unlock();
+    return RC_NO_FREE_FRAME;
+  }
+  pool->unlock();
+
+  // read the whole run with one call
+  long long start = IOStats::now();
+  ssize_t bytes = store->readv(iov, n, offsetOf(pid));
+  int pages = (bytes < 0) ? 0 : bytes / pageSize;
+  if (pages > 0) stats->countRead(pages, (long long)pages * pageSize, IOStats::now() - start);
+
+  // only the requested page stays pinned. the pages that could not be
+  // read are dropped.
+  pool->lock();
+  for (int i = 0; i < n; i++) {
+    pool->doneLoading(frames[i]);
+    if (i > 0 || pages == 0) pool->unpin(frames[i]);
+    if (i >= pages) pool->invalidate(fid, pid + i);
+  }
+  if (pages > 0) pool->touch(frames[0]);
+  pool->unlock();
+  if (pages == 0) return RC_FILE_READ_FAILED;
+
+  frame = frames[0];
+
+  // increase the page read count
+  readCount += pages;
+
+  return 0;
+}
+
+RC PageFile::read(PageId pid, void* buffer) const
+{
+  RC          rc;
+  int         frame;
+  BufferPool* pool;
+
+  // in 'm' mode, copy the page straight from the mapping
+  if (map) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+    memcpy(buffer, map + offsetOf(pid), pageSize);
+    PageTrace::record(fid, pid, PageTrace::READ, pageSize);
+    return 0;
+  }
+
+  if ((rc = fetch(pid, pool, frame)) < 0) return rc;
+  memcpy(buffer, pool->data(frame), pageSize);
+
+  pool->lock();
+  pool->unpin(frame);
+  pool->unlock();
+
+  PageTrace::record(fid, pid, PageTrace::READ, pageSize);
+  return 0;
+}
+
+RC PageFile::pin(PageId pid, PageHandle& page) const
+{
+  RC          rc;
+  int         frame;
+  BufferPool* pool;
+
+  page.release();
+
+  // in 'm' mode, the handle points into the mapping. nothing is pinned
+  // since the mapping lives until the file is closed.
+  if (map) {
+    if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+    page.page = map + offsetOf(pid);
+    page.writable = false;
+    page.owner = this;
+    page.pid = pid;
+    PageTrace::record(fid, pid, PageTrace::READ, pageSize);
+    return 0;
+  }
+
+  // the frame comes back pinned
+  if ((rc = fetch(pid, pool, frame)) < 0) return rc;
+
+  page.pool = pool;
+  page.frame = frame;
+  page.page = pool->data(frame);
+  page.writable = false;
+  page.owner = this;
+  page.pid = pid;
+
+  PageTrace::record(fid, pid, PageTrace::READ, pageSize);
+  return 0;
+}
+
+RC PageFile::prefetch(const PageId* pids, int count) const
+{
+  RC rc = 0;
+  vector<AsyncIO::Request> reqs;
+  vector<BufferPool*> shardList;
+  vector<int> frames;
+  vector<PageId> pending;
+
+  if (store == 0) return RC_FILE_READ_FAILED;
+
+  // in 'm' mode, let the kernel read the pages into the page cache
+  if (map) {
+    long sysPage = ::sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < count; i++) {
+      if (pids[i] < 0 || pids[i] >= epid) continue;
+      off_t offset = offsetOf(pids[i]) / sysPage * sysPage;
+      ::madvise(map + offset, offsetOf(pids[i]) + pageSize - offset, MADV_WILLNEED);
+    }
+    return 0;
+  }
+
+  // assign a frame to every page that is not cached yet. the frames stay
+  // pinned and marked as loading until the batch completes, so that the
+  // batch cannot evict its own pages and other threads wait for them.
+  // pages whose shard has no free frame are not prefetched.
+  for (int i = 0; i < count; i++) {
+    PageId pid = pids[i];
+    int    frame;
+    if (pid < 0 || pid >= epid) continue;
+
+    BufferPool* pool = shardOf(pid);
+    pool->lock();
+    if (pool->find(fid, pid) < 0 && pool->allocate(fid, pid, frame, true) == 0) {
+      pool->pin(frame);
+      pool->setLoading(frame);
+
+      AsyncIO::Request r;
+      r.fd = -1;
+      r.offset = offsetOf(pid);
+      r.buffer = pool->data(frame);
+      r.length = pageSize;
+      r.rc = 0;
+      reqs.push_back(r);
+      shardList.push_back(pool);
+      frames.push_back(frame);
+      pending.push_back(pid);
+    }
+    pool->unlock();
+  }
+  if (reqs.empty()) return 0;
+
+  long long start = IOStats::now();
+  store->readBatch(&reqs[0], reqs.size());
+  long long elapsed = IOStats::now() - start;
+
+  // drop the pages that could not be read. every page read is counted
+  // with the time the whole batch took, since that is when it was ready.
+  for (unsigned i = 0; i < reqs.size(); i++) {
+    BufferPool* pool = shardList[i];
+    pool->lock();
+    pool->doneLoading(frames[i]);
+    pool->unpin(frames[i]);
+    if (reqs[i].rc < 0) {
+      pool->invalidate(fid, pending[i]);
+      rc = reqs[i].rc;
+    } else {
+      readCount++;
+      stats->countRead(1, pageSize, elapsed);
+    }
+    pool->unlock();
+  }
+
+  return rc;
+}
+
+void PageFile::setSequential(bool on)
+{
+  sequential = on;
+  if (store == 0) return;
+
+  // let the kernel read ahead as well
+  if (map) {
+    ::madvise(map, mapSize, on ? MADV_SEQUENTIAL : MADV_NORMAL);
+  } else {
+    store->setSequential(on);
+  }
+}
+
+RC PageFile::pinForWrite(PageId pid, PageHandle& page)
+{
+  RC          rc;
+  int         frame;
+  BufferPool* pool;
+
+  page.release();
+  if (pid < 0) return RC_INVALID_PID;
+  if (pid > MAX_PID) return RC_FILE_TOO_LARGE;
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  if (pid < epid) {
+    // the frame comes back pinned
+    if ((rc = fetch(pid, pool, frame)) < 0) return rc;
+    pool->lock();
+  } else {
+    // a new page does not have to be read from the disk
+    pool = shardOf(pid);
+    pool->lock();
+    frame = pool->findLoaded(fid, pid);
+    if (frame >= 0) {
+      pool->touch(frame);
+    } else if ((rc = pool->allocate(fid, pid, frame)) < 0) {
+      pool->unlock();
+      return rc;
+    }
+    memset(pool->data(frame), 0, pageSize);
+    pool->pin(frame);
+    epid = pid + 1;
+  }
+  pool->markDirty(frame);
+  pool->unlock();
+
+  page.pool = pool;
+  page.frame = frame;
+  page.page = pool->data(frame);
+  page.writable = true;
+  page.owner = this;
+  page.pid = pid;
+
+  PageTrace::record(fid, pid, PageTrace::WRITE, pageSize);
+  return 0;
+}
+
+RC PageFile::allocatePage(PageId& pid)
+{
+  RC         rc;
+  PageHandle page;
+  FreePage   f;
+
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  // without free pages, the file grows by one zero-filled page
+  if (freeHead < 0) {
+    pid = epid;
+    return pinForWrite(pid, page);
+  }
+
+  // take the head of the free list
+  if ((rc = pinForWrite(freeHead, page)) < 0) return rc;
+  memcpy(&f, page.data(), sizeof(f));
+  if (f.magic != FREE_MAGIC) return RC_INVALID_FILE_FORMAT;
+
+  pid = freeHead;
+  freeHead = f.next;
+  freeCount--;
+  headerDirty = true;
+  memset(page.writableData(), 0, pageSize);
+
+  return 0;
+}
+
+RC PageFile::freePage(PageId pid)
+{
+  RC         rc;
+  PageHandle page;
+  FreePage   f;
+
+  if (!writable) return RC_FILE_WRITE_FAILED;
+  if (headerPages == 0) return RC_INVALID_FILE_FORMAT;
+  if (pid < 0 || pid >= epid) return RC_INVALID_PID;
+
+  // the page becomes the head of the free list
+  if ((rc = pinForWrite(pid, page)) < 0) return rc;
+  memcpy(&f, page.data(), sizeof(f));
+  if (f.magic == FREE_MAGIC) return RC_INVALID_PID;
+
+  f.magic = FREE_MAGIC;
+  f.next = freeHead;
+  memcpy(page.writableData(), &f, sizeof(f));
+  freeHead = pid;
+  freeCount++;
+  headerDirty = true;
+
+  return 0;
+}
+
+RC PageFile::truncate()
+{
+  if (!writable) return RC_FILE_WRITE_FAILED;
+
+  // the cached pages are dropped without writing the dirty ones back
+  for (int i = 0; i < SHARD_COUNT; i++) {
+    shards[i]->lock();
+    shards[i]->invalidateFile(fid);
+    shards[i]->unlock();
+  }
+  if (store->truncate(0) < 0) return RC_FILE_WRITE_FAILED;
+
+  // the file starts over with an empty header
+  headerPages = 1;
+  freeHead = -1;
+  freeCount = 0;
+  epid = 0;
+  lastPid = -1;
+  seqCount = 0;
+  pthread_mutex_lock(&fileLock);
+  fileIds[fid].base = offsetOf(0);
+  pthread_mutex_unlock(&fileLock);
+
+  return writeHeader();
+}
+
+bool PageFile::isFreePage(PageId pid) const
+{
+  PageHandle page;
+  FreePage   f;
+
+  if (freeCount == 0 || pin(pid, page) < 0) return false;
+  memcpy(&f, page.data(), sizeof(f));
+  return f.magic == FREE_MAGIC;
+}
+
+void PageHandle::markDirty()
+{
+  if (!writable || frame < 0) return;
+
+  pool->lock();
+  pool->markDirty(frame);
+  pool->unlock();
+}
+
+void PageHandle::release()
+{
+  if (page == 0) return;
+
+  if (frame >= 0) {
+    pool->lock();
+    // the page may have been written back while it was pinned
+    if (writable) pool->markDirty(frame);
+    pool->unpin(frame);
+    pool->unlock();
+  }
+  pool = 0;
+  frame = -1;
+  page = 0;
+  writable = false;
+  owner = 0;
+  pid = -1;
+}
+
+RC PageFile::setCacheSize(int mb)
+{
+  RC rc = 0;
+  if (mb <= 0) return RC_INVALID_ATTRIBUTE;
+
+  // pools created later get the new capacity as well
+  cacheSizeMB = mb;
+  for (int i = 0; i < POOL_COUNT; i++) {
+    for (int s = 0; s < SHARD_COUNT && pools[i][s]; s++) {
+      BufferPool* pool = pools[i][s];
+      pool->lock();
+      rc = pool->resize(shardFrames(pool->getFrameSize()));
+      pool->unlock();
+      if (rc < 0) return rc;
+    }
+  }
+  return 0;
+}
+
+void PageFile::setReplacementPolicy(BufferPool::Policy p)
+{
+  policy = p;
+  for (int i = 0; i < POOL_COUNT; i++) {
+    for (int s = 0; s < SHARD_COUNT && pools[i][s]; s++) {
+      pools[i][s]->lock();
+      pools[i][s]->setPolicy(p);
+      pools[i][s]->unlock();
+    }
+  }
+}
+
+RC PageFile::saveCachedPages(const string& filename)
+{
+  vector<int>        files;
+  vector<PageId>     pids;
+  vector<CachedPage> pages;
+  struct stat        statbuf;
+
+  for (int i = 0; i < POOL_COUNT; i++) {
+    for (int s = 0; s < SHARD_COUNT && pools[i][s]; s++) {
+      pools[i][s]->lock();
+      pools[i][s]->getPages(files, pids);
+      pools[i][s]->unlock();
+    }
+  }
+
+  // a name may have been reused by a newer file since the pages were
+  // cached, so only files still found under their name are listed
+  pthread_mutex_lock(&fileLock);
+  vector<bool> current(fileIds.size());
+  for (unsigned i = 0; i < fileIds.size(); i++) {
+    current[i] = !fileIds[i].name.empty() &&
+      ::stat(fileIds[i].name.c_str(), &statbuf) == 0 &&
+      statbuf.st_dev == fileIds[i].dev && statbuf.st_ino == fileIds[i].ino;
+  }
+  for (unsigned i = 0; i < files.size(); i++) {
+    if (current[files[i]]) pages.push_back(CachedPage(fileIds[files[i]].name, pids[i]));
+  }
+  pthread_mutex_unlock(&fileLock);
+  std::sort(pages.begin(), pages.end());
+
+  FILE* f = fopen(filename.c_str(), "w");
+  if (f == 0) return RC_FILE_OPEN_FAILED;
+  for (unsigned i = 0; i < pages.size(); i++) {
+    fprintf(f, "%d %s\n", pages[i].second, pages[i].first.c_str());
+  }
+  if (fclose(f) != 0) return RC_FILE_WRITE_FAILED;
+
+  return 0;
+}
+
+RC PageFile::warmUp(const string& filename)
+{
+  char   line[4096];
+  PageId pid;
+  int    n;
+
+  waitWarmUp();
+
+  FILE* f = fopen(filename.c_str(), "r");
+  if (f == 0) return RC_FILE_OPEN_FAILED;
+
+  vector<CachedPage>* pages = new vector<CachedPage>;
+  while (fgets(line, sizeof(line), f)) {
+    line[strcspn(line, "\n")] = 0;
+    if (sscanf(line, "%d %n", &pid, &n) == 1 && line[n]) {
+      pages->push_back(CachedPage(string(line + n), pid));
+    }
+  }
+  fclose(f);
+  std::sort(pages->begin(), pages->end());
+
+  if (pthread_create(&warmThread, NULL, warmUpThread, pages) != 0) {
+    delete pages;
+    return RC_FILE_READ_FAILED;
+  }
+  warming = true;
+
+  return 0;
+}
+
+void PageFile::waitWarmUp()
+{
+  if (!warming) return;
+  pthread_join(warmThread, NULL);
+  warming = false;
+}
+
+void* PageFile::warmUpThread(void* arg)
+{
+  vector<CachedPage>* pages = (vector<CachedPage>*)arg;
+
+  // open each file once and read its pages in batches
+  unsigned i = 0;
+  while (i < pages->size()) {
+    const string& name = (*pages)[i].first;
+    vector<PageId> pids;
+    for (; i < pages->size() && (*pages)[i].first == name; i++) {
+      pids.push_back((*pages)[i].second);
+    }
+
+    PageFile pf;
+    if (pf.open(name, 'r') < 0) continue;
+    for (unsigned j = 0; j < pids.size(); j += WARMUP_BATCH) {
+      int n = pids.size() - j;
+      pf.prefetch(&pids[j], (n < WARMUP_BATCH) ? n : WARMUP_BATCH);
+    }
+    pf.close();
+  }
+
+  delete pages;
+  return 0;
+}
@@ -10,27 +10,121 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <atomic>
 #include <string>
+#include <vector>
+#include <sys/types.h>
 #include "Bruinbase.h"
+#include "BufferPool.h"
+#include "IOStats.h"
+#include "StorageBackend.h"
 
-typedef int PageId;
+class PageFile;
 
 /**
- * read/write a file in the unit of a page
+ * a page pinned in the buffer pool by PageFile::pin() or
+ * PageFile::pinForWrite(). the page stays in memory while the handle
+ * holds it, so its bytes can be used in place without copying.
+ * the page is unpinned when the handle is released or destroyed.
+ */
+class PageHandle {
+ public:
+  PageHandle() : pool(0), frame(-1), page(0), writable(false), owner(0), pid(-1) {}
+  ~PageHandle() { release(); }
+
+  /**
+   * @return pointer to the bytes of the pinned page
+   */
+  const char* data() const { return page; }
+
+  /**
+   * @return pointer to the bytes of the pinned page if it was pinned
+   *         by pinForWrite(). otherwise NULL.
+   */
+  char* writableData() const { return writable ? page : 0; }
+
+  /**
+   * @return true if the handle holds page pid of the PageFile pf
+   */
+  bool holds(const PageFile& pf, PageId pid) const
+    { return page != 0 && owner == &pf && this->pid == pid; }
+
+  /**
+   * mark a page pinned by pinForWrite() dirty again. the buffer pool may
+   * write back a pinned page along with its neighbors, so changes made
+   * after the pin are only kept if the page is marked again.
+   */
+  void markDirty();
+
+  /**
+   * unpin the page, marking it dirty first if it was pinned by
+   * pinForWrite(). the handle becomes empty.
+   */
+  void release();
+
+ private:
+  // a handle owns its pin, so it cannot be copied
+  PageHandle(const PageHandle&);
+  PageHandle& operator=(const PageHandle&);
+
+  BufferPool*     pool;     // the buffer pool holding the pinned frame
+  int             frame;    // the pinned frame, -1 if the page is not in
+                            //   the buffer pool (empty or memory-mapped)
+  char*           page;     // the bytes of the page, NULL if empty
+  bool            writable; // true if pinned by pinForWrite()
+  const PageFile* owner;    // the file the page belongs to
+  PageId          pid;      // the id of the pinned page
+
+  friend class PageFile;
+};
+
+/**
+ * read/write a file in the unit of a page.
+ *
+ * the page size of a file is chosen when the file is created and is
+ * recorded in a header page at the beginning of the file. the header is
+ * not visible to the users of PageFile: page 0 is the first page after it.
+ * files without a header (created by older versions) use 1KB pages.
+ *
+ * pages that are no longer used can be freed with freePage(). free pages
+ * are linked into a list whose head is kept in the header, and
+ * allocatePage() reuses them before it grows the file.
+ *
+ * the buffer pools and the page counters are shared by all PageFiles and
+ * may be used by several threads at once, and the file is only accessed
+ * with positional reads and writes. a PageFile object itself is used by
+ * one thread at a time: threads reading the same file open it separately.
+ *
+ * the bytes of the file are kept by a StorageBackend: a unix file, a file
+ * in memory, or a simulated disk, as chosen by setStorage().
  */
 class PageFile {
  public:
 
-  static const int PAGE_SIZE = 1024;    // the size of a page is 1KB
+  static const int PAGE_SIZE = 1024;       // the default size of a page is 1KB
+  static const int MIN_PAGE_SIZE = 1024;   // the smallest supported page size
+  static const int MAX_PAGE_SIZE = 16384;  // the largest supported page size
+
+  static const int READ_AHEAD_SIZE = 65536; // # bytes read at once in a scan
+
+  // the largest page id of a file. offsets in the file are 64-bit, so a
+  // file can hold 2^31-1 pages: 2TB with 1KB pages, 32TB with 16KB pages.
+  static const PageId MAX_PID = 0x7ffffffe;
 
   PageFile();
   PageFile(const std::string& filename, char mode);
+  ~PageFile();
 
   /**
-   * open a file in read or write mode.
-   * when opened in 'w' mode, if the file does not exist, it is created.
+   * open a file in read, write or memory-mapped read mode.
+   * when opened in 'w' mode, if the file does not exist, it is created
+   * with the page size set by setDefaultPageSize().
+   * in 'm' mode the whole file is mapped into memory read-only, and
+   * pages are read from the mapping without system calls or the buffer
+   * pool. the file must not be modified while it is open in 'm' mode.
+   * storage that cannot be mapped is read as in 'r' mode.
    * @param filename[IN] the name of the file to open
-   * @param mode[IN] 'r' for read, 'w' for write
+   * @param mode[IN] 'r' for read, 'w' for write, 'm' for mapped read
    * @return error code. 0 if no error
    */
   RC open(const std::string& filename, char mode);
@@ -48,16 +142,116 @@ class PageFile {
    * @return error code. 0 if no error
    */
   RC read(PageId pid, void *buffer) const;
+
+  /**
+   * pin a disk page in the buffer pool and give read-only access to it
+   * without copying. any page held by the handle is released first.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] the handle holding the pinned page
+   * @return error code. 0 if no error
+   */
+  RC pin(PageId pid, PageHandle& page) const;
+
+  /**
+   * read many pages into the buffer pool with one batch of concurrent
+   * disk reads, so that later read() or pin() calls find them cached.
+   * pages that are already cached or out of range are skipped.
+   * in 'm' mode the kernel is asked to read the pages ahead instead.
+   * @param pids[IN] the pages to read
+   * @param count[IN] # pages in pids
+   * @return error code. 0 if no error
+   */
+  RC prefetch(const PageId* pids, int count) const;
+
+  /**
+   * tell the file whether its pages are about to be read in order.
+   * while the hint is on, every page missing from the buffer pool is read
+   * together with the pages following it in one large read, as is done
+   * automatically once a few pages have been read in sequence.
+   * @param on[IN] true before a sequential scan, false after it
+   */
+  void setSequential(bool on);
+
+  /**
+   * pin a disk page in the buffer pool for modification in place.
+   * the page is marked dirty, so changes made through the handle reach
+   * the disk like a write(). if (pid >= endPid()), the page starts
+   * zero-filled and the file is expanded as in write().
+   * any page held by the handle is released first.
+   * @param pid[IN] the page to pin
+   * @param page[OUT] the handle holding the pinned page
+   * @return error code. 0 if no error
+   */
+  RC pinForWrite(PageId pid, PageHandle& page);
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * a pid above MAX_PID fails with RC_FILE_TOO_LARGE.
+   * the page is kept dirty in the buffer pool and written to the disk
+   * when it is evicted, when flush() is called or when the file is closed.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
    */
   RC write(PageId pid, const void *buffer);
+
+  /**
+   * get a page for new content: the most recently freed page, or a new
+   * page at the end of the file if no page is free. the page is
+   * zero-filled and counts as written, so endPid() covers it.
+   * @param pid[OUT] the allocated page
+   * @return error code. 0 if no error
+   */
+  RC allocatePage(PageId& pid);
+
+  /**
+   * add a page to the free list, to be reused by allocatePage(). the
+   * content of the page is lost. the file does not shrink.
+   * files without a header (created by older versions) cannot free pages;
+   * they can only be emptied with truncate().
+   * @param pid[IN] the page to free
+   * @return error code. RC_INVALID_PID if the page is already free
+   */
+  RC freePage(PageId pid);
+
+  /**
+   * @return true if freePage() works on the file, false for a file
+   *         without a header
+   */
+  bool canFreePages() const { return headerPages > 0; }
+
+  /**
+   * remove every page of the file, so that endPid() becomes 0. the
+   * cached pages of the file are dropped, and no page of it may be
+   * pinned. a file without a header gets one, with its page size of 1KB,
+   * so that its pages can be freed from then on.
+   * @return error code. 0 if no error
+   */
+  RC truncate();
+
+  /**
+   * @return true if page pid is on the free list
+   */
+  bool isFreePage(PageId pid) const;
+
+  /**
+   * @return # pages on the free list
+   */
+  int getFreePageCount() const { return freeCount; }
+
+  /**
+   * write all dirty pages of the file to the disk.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * write the dirty pages of all files to the disk (checkpoint).
+   * @return error code. 0 if no error
+   */
+  static RC flushAll();
     
   /**
    * note the +1 part. The last page id in the file is actually endPid()-1.
@@ -67,46 +261,275 @@ class PageFile {
   PageId endPid() const;
 
   /**
-   * @return the total # of disk reads
+   * @return the size of the pages of the file in bytes
+   */
+  int getPageSize() const { return pageSize; }
+
+  /**
+   * set the page size of the files created from now on.
+   * @param size[IN] a power of two between MIN_PAGE_SIZE and MAX_PAGE_SIZE
+   * @return error code. 0 if no error
+   */
+  static RC setDefaultPageSize(int size);
+
+  /**
+   * open the files from now on with O_DIRECT, so that their pages are
+   * cached only in the buffer pool and not again in the kernel page cache.
+   * direct I/O is used for files whose page size is a multiple of
+   * BufferPool::ALIGNMENT and opened in 'r' or 'w' mode, on file systems
+   * that support it. other files are read and written as usual.
+   * @param on[IN] true to use O_DIRECT
+   */
+  static void setDirectIO(bool on) { directIO = on; }
+
+  /**
+   * choose where the files opened from now on keep their pages.
+   * @param spec[IN] "file", "memory" or "sim:<latency_us>,<MB/s>".
+   *                 see StorageBackend.
+   * @return error code. 0 if no error
+   */
+  static RC setStorage(const std::string& spec)
+    { return StorageBackend::setDefault(spec); }
+
+  /**
+   * @return true if the file is read and written with O_DIRECT
+   */
+  bool isDirect() const { return direct; }
+
+  /**
+   * @return the total # of pages read from the disk
    */
   static int getPageReadCount()  { return readCount; }
   
   /**
-   * @return the total # of disk writes
+   * @return the total # of pages written to the disk
    */
   static int getPageWriteCount() { return writeCount; }
 
+  /**
+   * @return the total # of page reads served from the buffer pools
+   */
+  static int getCacheHitCount();
+
+  /**
+   * @return the total # of page reads that missed the buffer pools
+   */
+  static int getCacheMissCount();
+
+  /**
+   * get the I/O counters of every file opened so far, in the order the
+   * files were first opened. the counters of a file cover all the times
+   * it was opened; a file reopened under another name keeps its counters.
+   * @param names[OUT] the name each file was last opened with
+   * @param stats[OUT] a snapshot of the counters of each file
+   */
+  static void getFileStats(std::vector<std::string>& names, std::vector<IOStats>& stats);
+
+  /**
+   * change the capacity of the buffer pools shared by all PageFiles.
+   * files of each page size share one pool of this capacity.
+   * all cached pages are dropped.
+   * @param mb[IN] the new capacity in megabytes
+   * @return error code. 0 if no error
+   */
+  static RC setCacheSize(int mb);
+
+  /**
+   * choose the page replacement policy of the buffer pools.
+   * the default is BufferPool::TWO_Q.
+   * @param policy[IN] BufferPool::LRU or BufferPool::TWO_Q
+   */
+  static void setReplacementPolicy(BufferPool::Policy policy);
+
+  /**
+   * write the list of the pages cached in the buffer pools to a text file,
+   * one "pid filename" line per page, so that a later process can read
+   * them back with warmUp(). pages of files that no longer exist under
+   * the name they were opened with are left out.
+   * @param filename[IN] the file to write the list to
+   * @return error code. 0 if no error
+   */
+  static RC saveCachedPages(const std::string& filename);
+
+  /**
+   * start reading the pages listed by saveCachedPages() into the buffer
+   * pools in a background thread, file by file and in pid order, so that
+   * the first queries after a restart find the pages they used before.
+   * missing files and pages are skipped.
+   * @param filename[IN] the file written by saveCachedPages()
+   * @return error code. 0 if the thread was started
+   */
+  static RC warmUp(const std::string& filename);
+
+  /**
+   * wait until the pages of warmUp() have been read. does nothing if no
+   * warm-up is running.
+   */
+  static void waitWarmUp();
+
  protected:
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
+   * find the frame holding a page, reading the page from the disk
+   * into the buffer pool if it is not cached. the frame is returned
+   * pinned; the caller unpins it with the lock of the pool held.
+   * @param pid[IN] the page to fetch
+   * @param pool[OUT] the buffer pool holding the page
+   * @param frame[OUT] the frame holding the page
+   * @return error code. 0 if no error
+   */
+  RC fetch(PageId pid, BufferPool*& pool, int& frame) const;
+
+  /**
+   * read a missing page and as many of the uncached pages after it as fit
+   * in READ_AHEAD_SIZE bytes (and in its shard) into the buffer pool with
+   * a single read. called by fetch() with the lock of pool held; the lock
+   * is released on return.
+   * @param pid[IN] the page to read
+   * @param pool[IN] the buffer pool for pid
+   * @param frame[OUT] the pinned frame holding the page
    * @return error code. 0 if no error
    */
-  RC seek(PageId pid) const;
+  RC readAhead(PageId pid, BufferPool* pool, int& frame) const;
 
  private:
-  int     fd;     // file descriptor of the associated unix file
+  StorageBackend* store; // the storage of the file, NULL if not open
+  int     fid;    // id of the file in the buffer pool
   PageId  epid;   // (last page id + 1) of the file
+  int     pageSize;    // the size of a page of the file
+  int     headerPages; // # pages before page 0 (1, or 0 for old files)
+  bool    writable; // true if the file was opened in 'w' mode
+  char*   map;    // the mapped file in 'm' mode, NULL otherwise
+  size_t  mapSize; // the length of the mapping in bytes
+  BufferPool** shards; // the buffer pools for the page size of the file
+  bool    sequential; // true while a sequential scan is announced
+  bool    direct; // true if the file is opened with O_DIRECT
+  PageId  freeHead;  // the first page of the free list, -1 if none
+  int     freeCount; // # pages on the free list
+  bool    headerDirty; // true if the free list changed since the header was written
+  IOStats* stats; // the I/O counters of the file
 
-  //
-  // the following set of members implement LRU caching 
-  //
-  static const int CACHE_COUNT = 10;
+  // the last page fetched and # pages fetched in sequence before it.
+  // used to detect a sequential scan without a hint.
+  mutable PageId lastPid;
+  mutable int    seqCount;
+  static const int SEQ_THRESHOLD = 2; // # pages in sequence to start read-ahead
 
-  static int cacheClock; // clock tick counter for LRU policy
+  // the header page at the beginning of a file.
+  // version 1 headers end after pageSize and have no free list.
+  struct FileHeader {
+    int magic;     // FILE_MAGIC
+    int version;   // FILE_VERSION
+    int pageSize;  // the size of the pages of the file
+    PageId freeHead;  // the first page of the free list, -1 if none
+    int freeCount;    // # pages on the free list
+  };
+  static const int FILE_MAGIC = 0x46504242;  // "BBPF"
+  static const int FILE_VERSION = 2;
+
+  // the beginning of a page on the free list
+  struct FreePage {
+    int    magic;  // FREE_MAGIC
+    PageId next;   // the next page of the free list, -1 if none
+  };
+  static const int FREE_MAGIC = 0x45455246;  // "FREE"
+
+  // the page size of newly created files
+  static int defaultPageSize;
+
+  // true if files are opened with O_DIRECT when possible
+  static bool directIO;
+
+  // the buffer pools caching the pages of all files. the pages of each
+  // page size are spread over SHARD_COUNT pools ("shards") with a lock
+  // each, so threads working on different pages rarely wait for each other.
+  // pools[i][s] holds pages of (MIN_PAGE_SIZE << i) bytes; the pools of a
+  // page size are created when the first file of that size is opened.
+  // the shard of a page is chosen by its file and by pid / SHARD_PAGES, so
+  // runs of consecutive pages stay in one shard and are still written and
+  // read ahead together.
+  // pages are identified by the id of their file and their pid.
+  // a file keeps its id (and its cached pages) after it is closed,
+  // so reopening the file in a later query finds its pages in the pool.
+  static const int POOL_COUNT = 5;
+  static const int SHARD_COUNT = 8;
+  static const int SHARD_PAGES = 64;
+  static const int MIN_SHARD_FRAMES = 16; // the smallest capacity of a shard
+  static BufferPool* pools[POOL_COUNT][SHARD_COUNT];
+  static int cacheSizeMB;  // the capacity of the pools of each page size
+  static BufferPool::Policy policy; // the replacement policy of the pools
+
+  /**
+   * @return the SHARD_COUNT buffer pools for pages of the given size
+   */
+  static BufferPool** poolFor(int pageSize);
+
+  /**
+   * @return the buffer pool caching page pid of the file
+   */
+  BufferPool* shardOf(PageId pid) const
+    { return shards[((unsigned)fid * 31 + (unsigned)(pid / SHARD_PAGES)) % SHARD_COUNT]; }
+
+  /**
+   * @return # frames of each shard for a total capacity of cacheSizeMB
+   */
+  static int shardFrames(int pageSize);
+
+  /**
+   * write back the dirty pages of a file cached in a set of shards.
+   * @param file[IN] the id of the file. -1 flushes all files
+   */
+  static RC flushShards(BufferPool** shards, int file);
+
+  /**
+   * @return the offset of page pid in the file
+   */
+  off_t offsetOf(PageId pid) const
+    { return ((off_t)pid + headerPages) * pageSize; }
+
+  /**
+   * read the header page of an existing file or write one for a new file,
+   * and set pageSize and headerPages.
+   * @param size[IN] the size of the file in bytes
+   * @return error code. 0 if no error
+   */
+  RC readHeader(off_t size);
+
+  /**
+   * close and delete the storage after open() failed.
+   */
+  void closeStore();
+
+  /**
+   * write the header page with the page size and the free list.
+   * @return error code. 0 if no error
+   */
+  RC writeHeader();
+
+  /**
+   * get the buffer pool id of the file with the given device and inode
+   * numbers, assigning a new id (and new I/O counters) if the file has not
+   * been seen before.
+   */
+  static int fileId(dev_t dev, ino_t ino);
+
+  /**
+   * write count consecutive dirty pages starting at pid back to a file.
+   * this is the write-back function of the buffer pool.
+   */
+  static RC writeBack(int file, PageId pid, const struct iovec* iov, int count);
+
+  static const int WARMUP_BATCH = 64;  // # pages read at once by warmUp()
+
+  /**
+   * the body of the warm-up thread.
+   * @param arg[IN] the pages to read, sorted by file name and pid
+   */
+  static void* warmUpThread(void* arg);
 
-  // the actual cache data structure
-  static struct cacheStruct {
-    int    fd;              // file id of the cached page
-    PageId pid;             // page id of the cached page
-    int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  friend class PageHandle;
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static std::atomic<int> readCount;  // total # of page reads 
+  static std::atomic<int> writeCount; // total # of page writes 
 };
   
 #endif // PAGEFILE_H
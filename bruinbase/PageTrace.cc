@@ -0,0 +1,107 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "PageTrace.h"
+#include "IOStats.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+
+using std::string;
+
+std::atomic<bool> PageTrace::on(false);
+
+// the state of the trace being recorded, protected by traceLock
+static pthread_mutex_t traceLock = PTHREAD_MUTEX_INITIALIZER;
+static int traceFd = -1;         // the trace file
+static long long startTime = 0;  // when the trace was started, in microseconds
+static PageTrace::Record* block = 0;  // the records not written yet
+static int blockCount = 0;       // # records in block
+
+RC PageTrace::start(const string& filename)
+{
+  Header header;
+
+  stop();
+
+  int fd = ::open(filename.c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+  if (fd < 0) return RC_FILE_OPEN_FAILED;
+
+  header.magic = TRACE_MAGIC;
+  header.version = TRACE_VERSION;
+  if (::write(fd, &header, sizeof(header)) != sizeof(header)) {
+    ::close(fd);
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  pthread_mutex_lock(&traceLock);
+  if (block == 0) block = new Record[BLOCK_RECORDS];
+  blockCount = 0;
+  traceFd = fd;
+  startTime = IOStats::now();
+  on = true;
+  pthread_mutex_unlock(&traceLock);
+
+  return 0;
+}
+
+RC PageTrace::stop()
+{
+  RC rc = 0;
+
+  pthread_mutex_lock(&traceLock);
+  if (traceFd >= 0) {
+    on = false;
+    rc = writeBlock();
+    if (::close(traceFd) < 0 && rc == 0) rc = RC_FILE_CLOSE_FAILED;
+    traceFd = -1;
+  }
+  pthread_mutex_unlock(&traceLock);
+
+  return rc;
+}
+
+void PageTrace::record(int file, PageId pid, unsigned char op, int pageSize)
+{
+  if (!on) return;
+
+  // the page size is a power of two from 1KB up
+  unsigned char shift = 0;
+  while ((1024 << shift) < pageSize) shift++;
+
+  pthread_mutex_lock(&traceLock);
+  if (traceFd >= 0) {
+    Record& r = block[blockCount++];
+    r.time = IOStats::now() - startTime;
+    r.pid = pid;
+    r.file = (unsigned short)file;
+    r.op = op;
+    r.sizeShift = shift;
+    if (blockCount == BLOCK_RECORDS) writeBlock();
+  }
+  pthread_mutex_unlock(&traceLock);
+}
+
+RC PageTrace::writeBlock()
+{
+  ssize_t size = (ssize_t)blockCount * sizeof(Record);
+  ssize_t written = (size > 0) ? ::write(traceFd, block, size) : 0;
+  blockCount = 0;
+
+  return (written == size) ? 0 : RC_FILE_WRITE_FAILED;
+}
+
+RC PageTrace::readHeader(FILE* f)
+{
+  Header header;
+
+  if (fread(&header, sizeof(header), 1, f) != 1) return RC_FILE_READ_FAILED;
+  if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION) {
+    return RC_INVALID_FILE_FORMAT;
+  }
+  return 0;
+}
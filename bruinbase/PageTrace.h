@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PAGETRACE_H
+#define PAGETRACE_H
+
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include "Bruinbase.h"
+
+/**
+ * a log of every page read and written through PageFile, kept in a
+ * compact binary file. a trace of a real query mix can be replayed
+ * offline by simtrace against other buffer pool sizes and replacement
+ * policies.
+ *
+ * the file starts with a Header followed by Records. records are
+ * collected in memory and written in blocks, so tracing costs little
+ * more than a copy per page access. several threads may record at once.
+ */
+class PageTrace {
+ public:
+
+  /**
+   * the beginning of a trace file
+   */
+  struct Header {
+    int magic;    // TRACE_MAGIC
+    int version;  // TRACE_VERSION
+  };
+  static const int TRACE_MAGIC = 0x54504242;  // "BBPT"
+  static const int TRACE_VERSION = 1;
+
+  /**
+   * one page access. 16 bytes.
+   */
+  struct Record {
+    long long      time;      // microseconds since the trace was started
+    PageId         pid;       // the page accessed
+    unsigned short file;      // the buffer pool id of the file
+    unsigned char  op;        // READ or WRITE
+    unsigned char  sizeShift; // the page size is (1024 << sizeShift)
+  };
+  static const unsigned char READ = 'r';
+  static const unsigned char WRITE = 'w';
+
+  /**
+   * start recording page accesses to a new trace file.
+   * a trace already being recorded is stopped first.
+   * @param filename[IN] the trace file to create
+   * @return error code. 0 if no error
+   */
+  static RC start(const std::string& filename);
+
+  /**
+   * write the remaining records and close the trace file.
+   * @return error code. 0 if no error
+   */
+  static RC stop();
+
+  /**
+   * @return true while a trace is being recorded
+   */
+  static bool isOn() { return on; }
+
+  /**
+   * add a page access to the trace. does nothing if no trace is recorded.
+   * @param file[IN] the buffer pool id of the file
+   * @param pid[IN] the page accessed
+   * @param op[IN] READ or WRITE
+   * @param pageSize[IN] the page size of the file
+   */
+  static void record(int file, PageId pid, unsigned char op, int pageSize);
+
+  /**
+   * check the header of a trace file opened for reading. the records
+   * can then be read with fread() one Record at a time.
+   * @param f[IN] the trace file
+   * @return error code. 0 if no error
+   */
+  static RC readHeader(FILE* f);
+
+ private:
+  static const int BLOCK_RECORDS = 4096;  // # records written at once
+
+  static std::atomic<bool> on;  // true while a trace is recorded
+
+  /**
+   * write the records collected in memory to the trace file.
+   * called with the trace lock held.
+   */
+  static RC writeBlock();
+};
+
+#endif // PAGETRACE_H
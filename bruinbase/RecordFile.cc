@@ -9,9 +9,13 @@
 
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include <algorithm>
+#include <climits>
 #include <cstring>
+#include <vector>
 
 using std::string;
+using std::vector;
 
 //
 // helper functions for page manipultation
@@ -32,6 +36,140 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+//
+// helper functions for pages in the SLOTTED format
+//
+
+// the beginning of a page in the SLOTTED format. a page in the FIXED
+// format starts with # records in it instead, which is never the magic.
+struct SlottedHeader {
+  int magic;    // SLOTTED_MAGIC
+  int count;    // # records in the page
+  int freeEnd;  // the offset of the lowest record in the page
+};
+static const int SLOTTED_MAGIC = 0x544f4c53;  // "SLOT"
+
+// an entry of the slot directory, which follows the header. a record is
+// its key followed by the characters of its value, without a NUL.
+struct Slot {
+  unsigned short offset;  // the offset of the record in the page
+  unsigned short length;  // the length of the record in bytes
+};
+
+// check whether the page is in the SLOTTED format
+static bool isSlotted(const char* page);
+
+// make the page an empty page in the SLOTTED format
+static void initSlotted(char* page, int pageSize);
+
+// get # records stored in the page in the SLOTTED format
+static int getSlottedCount(const char* page);
+
+// check whether a record with the value fits in the free space of the page
+static bool hasRoom(const char* page, const std::string& value);
+
+// read the record in the n'th slot in the page
+static void readSlotted(const char* page, int n, int& key, std::string& value);
+
+// add the record after the last slot of the page, which must have room
+static void appendSlotted(char* page, int key, const std::string& value);
+
+//
+// helper functions for pages in the COLUMNAR format
+//
+
+// the most value pages that follow a key page
+static const int MAX_VALUE_PAGES = 30;
+
+// # key pages a scan of the keys reads ahead at once
+static const int KEY_PREFETCH = 64;
+
+// the beginning of a key page in the COLUMNAR format. the keys of the
+// records follow the header, and their values are stored in order in the
+// value pages right after the key page.
+struct ColumnHeader {
+  int magic;       // KEYS_MAGIC
+  int count;       // # records in the page
+  int valuePages;  // # value pages after the page
+  unsigned short firstSid[MAX_VALUE_PAGES];  // the first record whose
+                                             // value is in each value page
+};
+static const int KEYS_MAGIC = 0x5359454b;    // "KEYS"
+
+// a value page starts with a SlottedHeader with this magic. its records
+// are the characters of the values, without keys.
+static const int VALUES_MAGIC = 0x534c4156;  // "VALS"
+
+// check whether the page is a key page in the COLUMNAR format
+static bool isKeyPage(const char* page);
+
+// check whether the page is a value page in the COLUMNAR format
+static bool isValuePage(const char* page);
+
+// # keys a key page of pageSize bytes holds
+static int keysPerPage(int pageSize);
+
+// get the header of a key page
+static ColumnHeader getColumnHeader(const char* page);
+
+// check whether the value fits in the free space of a value page
+static bool hasValueRoom(const char* page, const std::string& value);
+
+// add the value after the last slot of a value page, which must have room
+static void appendValue(char* page, const std::string& value);
+
+//
+// helper functions for pages in the COMPRESSED format
+//
+
+// the beginning of a page in the COMPRESSED format. the records follow
+// the header back to back, each encoded as
+//   varint  zigzag(key - baseKey)
+//   varint  # leading characters shared with the previous value
+//   varint  # other characters
+//   the other characters of the value
+// every RESTART_INTERVAL'th record, starting with the first, is a restart
+// point: its value shares nothing with the previous one. the offsets of
+// the restart points are stored at the end of the page, the first one
+// last, so a record is decoded from the restart point before it.
+struct CompressedHeader {
+  int magic;    // COMPRESSED_MAGIC
+  int count;    // # records in the page
+  int baseKey;  // the key of the first record
+  int dataEnd;  // the offset after the last record
+};
+static const int COMPRESSED_MAGIC = 0x524d4f43;  // "COMR"
+static const int RESTART_INTERVAL = 16;
+
+// pages written before there were restart points are decoded from their
+// first record on
+static const int OLD_COMPRESSED_MAGIC = 0x504d4f43;  // "COMP"
+
+// the longest encoding of a record
+static const int MAX_ENCODED_LENGTH = 5 + 1 + 1 + RecordFile::MAX_VALUE_LENGTH;
+
+// check whether the page is in the COMPRESSED format
+static bool isCompressed(const char* page);
+
+// encode a record after a record with the value prev into buffer
+// (MAX_ENCODED_LENGTH bytes). returns # bytes used.
+static int encodeRecord(char* buffer, int baseKey, int key, const std::string& value,
+                        const std::string& prev);
+
+// decode the record at offset in a page with the base key, whose previous
+// value is in value, and move offset to the next record
+static void decodeRecord(const char* page, int baseKey, int& offset, int& key, std::string& value);
+
+// get the base key of a page in the COMPRESSED format
+static int getBaseKey(const char* page);
+
+// get # restart points of a page in the COMPRESSED format with the header
+static int getRestartCount(const CompressedHeader& h);
+
+// find the restart point at or before record sid of a page in the
+// COMPRESSED format. returns its offset, and its record in first.
+static int findRestart(const char* page, int pageSize, int sid, int& first);
+
 
 //
 // helper functions for RecordId manipulation
@@ -107,27 +245,76 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  recordsPerPage = RECORDS_PER_PAGE;
+  format = SLOTTED;
+  countPid = -1;
+  countOfPid = 0;
+  nextOfPid = 0;
+  lastValuePid = -1;
+  zoneState = ZONES_UNREAD;
+  zonesDirty = false;
+  resetStats();
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  recordsPerPage = RECORDS_PER_PAGE;
+  format = SLOTTED;
+  countPid = -1;
+  countOfPid = 0;
+  nextOfPid = 0;
+  lastValuePid = -1;
+  zoneState = ZONES_UNREAD;
+  zonesDirty = false;
+  resetStats();
   open(filename, mode);
 }
 
 RC RecordFile::open(const string& filename, char mode)
 {
   RC   rc;
-  char page[PageFile::PAGE_SIZE];
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
-  
-  //
-  // in the rest of this function, we set the end record id
-  //
+  recordsPerPage = slotsPerPage(pf.getPageSize());
+  countPid = -1;
+  lastValuePid = -1;
+
+  // an empty file gets its records in the SLOTTED format. otherwise the
+  // format is that of the pages already in the file.
+  format = SLOTTED;
+
+  // set the end record id
+  if ((rc = findEnd()) < 0) return rc;
+
+  // the zone map is read when a filtered scan needs it. a file opened for
+  // appending keeps it up to date, rebuilding it if it is missing or stale.
+  zoneName = filename + ".zone";
+  zones.clear();
+  resetStats();
+  zoneState = ZONES_UNREAD;
+  zonesDirty = false;
+  if (mode == 'w' || mode == 'W') {
+    readZones();
+    if (zoneState != ZONES_VALID) rebuildZones();
+  }
 
-  // get the end pid of the file
+  return 0;
+}
+
+RC RecordFile::findEnd()
+{
+  RC   rc;
+  char page[PageFile::MAX_PAGE_SIZE];
+
+  // get the end pid of the file. pages at the end of the file that
+  // are on the free list hold no records. clear() only left them in
+  // files emptied before it truncated the file.
   erid.pid = pf.endPid();
+  for (int i = 0; i < pf.getFreePageCount() && erid.pid > 0; i++) {
+    if (!pf.isFreePage(erid.pid - 1)) break;
+    erid.pid--;
+  }
 
   // if the end pid is zero, the file is empty.
   // set the end record id to (0, 0).
@@ -146,9 +333,36 @@ RC RecordFile::open(const string& filename, char mode)
     return rc;
   }
 
-  // get # records in the last page
+  // get # records in the last page. a page in the SLOTTED format is
+  // full when the next record does not fit, which append() finds out.
+  if (isSlotted(page)) {
+    erid.sid = getSlottedCount(page);
+    return 0;
+  }
+
+  if (isCompressed(page)) {
+    format = COMPRESSED;
+    erid.sid = getSlottedCount(page);
+    return 0;
+  }
+
+  // in the COLUMNAR format, the records end in the last key page, which
+  // is followed by its value pages
+  if (isValuePage(page) || isKeyPage(page)) {
+    format = COLUMNAR;
+    for (int i = 0; !isKeyPage(page); i++) {
+      if (erid.pid == 0 || i == MAX_VALUE_PAGES || (rc = pf.read(--erid.pid, page)) < 0) {
+        erid.pid = erid.sid = 0;
+        pf.close();
+        return (rc < 0) ? rc : RC_INVALID_FILE_FORMAT;
+      }
+    }
+    erid.sid = getColumnHeader(page).count;
+    return 0;
+  }
+  format = FIXED;
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  if (erid.sid >= recordsPerPage) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
@@ -159,70 +373,734 @@ RC RecordFile::open(const string& filename, char mode)
 
 RC RecordFile::close()
 {
+  RC rc = 0;
+
+  // the zone map describes the records up to the end record id
+  if (zonesDirty) rc = writeZones();
+  zones.clear();
+  resetStats();
+  zoneState = ZONES_UNREAD;
+  zonesDirty = false;
+
   erid.pid = 0;
   erid.sid = 0;
 
-  return pf.close();
+  RC error = pf.close();
+  return (rc < 0) ? rc : error;
 }
 
 RC RecordFile::read(const RecordId& rid, int& key, string& value) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  RC         rc;
+  PageHandle page;
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RC_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= RecordFile::RECORDS_PER_PAGE) return RC_INVALID_RID;
+  if (rid.sid < 0 || (format == FIXED && rid.sid >= recordsPerPage)) return RC_INVALID_RID;
   if (rid >= erid) return RC_INVALID_RID;
   
-  // read the page containing the record
-  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  // pin the page containing the record
+  if ((rc = pf.pin(rid.pid, page)) < 0) return rc;
 
-  // read the record from the slot in the page
-  readSlot(page, rid.sid, key, value);
+  // read the record from the slot in the pinned page
+  if (format == FIXED) {
+    readSlot(page.data(), rid.sid, key, value);
+    return 0;
+  }
+
+  countPid = rid.pid;
+  countOfPid = getSlottedCount(page.data());
+  nextOfPid = nextPage(rid.pid, page.data());
+  if (rid.sid >= countOfPid) return RC_INVALID_RID;
+  if (format == SLOTTED) {
+    readSlotted(page.data(), rid.sid, key, value);
+    return 0;
+  }
+
+  // in the COMPRESSED format, the records from the restart point before
+  // it are decoded first
+  if (format == COMPRESSED) {
+    int first;
+    int offset = findRestart(page.data(), pf.getPageSize(), rid.sid, first);
+    value.clear();
+    int baseKey = getBaseKey(page.data());
+    for (int i = first; i <= rid.sid; i++) decodeRecord(page.data(), baseKey, offset, key, value);
+    return 0;
+  }
+
+  // in the COLUMNAR format, the value is in one of the value pages
+  ScanCursor  cursor;
+  const char* ptr;
+  int         length;
+
+  cursor.rid = rid;
+  cursor.rid.sid++;
+  if ((rc = pf.pin(rid.pid, cursor.page)) < 0) return rc;
+  readInPlace(page.data(), rid.sid, key, ptr, length);
+  if ((rc = readValue(cursor, ptr, length)) < 0) return rc;
+  value.assign(ptr, length);
 
   return 0;
 }
 
-RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+void RecordFile::startScan(ScanCursor& cursor, const ZoneFilter* filter, bool keysOnly) const
 {
-  RC   rc;
-  char page[PageFile::PAGE_SIZE];
+  cursor.rid.pid = 0;
+  cursor.rid.sid = 0;
+  cursor.page.release();
+  cursor.valuePage.release();
+  cursor.count = 0;
+  cursor.filter = filter;
+  cursor.keysOnly = keysOnly;
+  cursor.prefetchEnd = 0;
+
+  if ((filter || keysOnly) && zoneState == ZONES_UNREAD) readZones();
+}
+
+RC RecordFile::readNext(ScanCursor& cursor, int& key, const char*& value, int& length) const
+{
+  RC rc;
+
+  // pin the next page with records when those of the pinned page are used up
+  while (!cursor.page.holds(pf, cursor.rid.pid) || cursor.rid.sid >= cursor.count) {
+    if (cursor.page.holds(pf, cursor.rid.pid)) {
+      cursor.rid.pid = nextPage(cursor.rid.pid, cursor.page.data());
+      cursor.rid.sid = 0;
+    }
+    if (cursor.rid >= erid) {
+      cursor.page.release();
+      cursor.valuePage.release();
+      return RC_END_OF_FILE;
+    }
+
+    // skip the pages whose zone shows that none of their records is
+    // wanted. the value pages of the COLUMNAR format have empty zones,
+    // so they are skipped as well.
+    if (cursor.filter && zoneState == ZONES_VALID &&
+        cursor.rid.pid < (PageId)zones.size() &&
+        !cursor.filter->matches(zones[cursor.rid.pid])) {
+      cursor.page.release();
+      cursor.rid.pid++;
+      cursor.rid.sid = 0;
+      continue;
+    }
 
-  // unless we are writing to the the first slot of an empty page,
-  // we have to read the page first
-  if (erid.sid > 0) {
-    if ((rc = pf.read(erid.pid, page)) < 0) return rc;
+    // a scan of the keys of a COLUMNAR table reads the next key pages
+    // with one batch of disk reads. the key pages are those with records
+    // in the zone map, so the value pages between them are not read.
+    if (format == COLUMNAR && cursor.keysOnly && zoneState == ZONES_VALID &&
+        cursor.rid.pid >= cursor.prefetchEnd) {
+      vector<PageId> pids;
+      PageId pid;
+      for (pid = cursor.rid.pid; pid < (PageId)zones.size() && (int)pids.size() < KEY_PREFETCH; pid++) {
+        if (zones[pid].minKey > zones[pid].maxKey) continue;
+        if (cursor.filter && !cursor.filter->matches(zones[pid])) continue;
+        pids.push_back(pid);
+      }
+      cursor.prefetchEnd = pid;
+      if (!pids.empty()) pf.prefetch(&pids[0], pids.size());
+    }
+
+    if ((rc = pf.pin(cursor.rid.pid, cursor.page)) < 0) return rc;
+
+    if (format != FIXED) {
+      cursor.count = getSlottedCount(cursor.page.data());
+      cursor.offset = sizeof(CompressedHeader);
+      cursor.baseKey = getBaseKey(cursor.page.data());
+    } else {
+      cursor.count = std::min(getRecordCount(cursor.page.data()), recordsPerPage);
+    }
+    if (cursor.rid.pid == erid.pid) cursor.count = std::min(cursor.count, erid.sid);
+  }
+
+  // a COMPRESSED record is decoded into the buffer of the cursor. the
+  // records of a page are read in order, so each value only changes the
+  // end of the previous one.
+  if (format == COMPRESSED) {
+    decodeRecord(cursor.page.data(), cursor.baseKey, cursor.offset, key, cursor.buffer);
+    value = cursor.buffer.data();
+    length = cursor.buffer.size();
+    cursor.rid.sid++;
+    return 0;
+  }
+
+  // read the record in place
+  readInPlace(cursor.page.data(), cursor.rid.sid, key, value, length);
+  cursor.rid.sid++;
+
+  // in the COLUMNAR format, the value is read from its own page
+  if (format == COLUMNAR && !cursor.keysOnly) return readValue(cursor, value, length);
+
+  return 0;
+}
+
+RC RecordFile::readValue(ScanCursor& cursor, const char*& value, int& length) const
+{
+  RC  rc;
+  int key;
+  int sid = cursor.rid.sid - 1;
+
+  if (!cursor.page.holds(pf, cursor.rid.pid) || sid < 0) return RC_INVALID_CURSOR;
+  if (format == COMPRESSED) {
+    value = cursor.buffer.data();
+    length = cursor.buffer.size();
+    return 0;
+  }
+  if (format != COLUMNAR) {
+    readInPlace(cursor.page.data(), sid, key, value, length);
+    return 0;
+  }
+
+  // find the value page of the record from the first record of each
+  // value page, and keep it pinned for the next records
+  ColumnHeader h = getColumnHeader(cursor.page.data());
+  int n = 0;
+  while (n + 1 < h.valuePages && h.firstSid[n + 1] <= sid) n++;
+  PageId pid = cursor.rid.pid + 1 + n;
+  if (!cursor.valuePage.holds(pf, pid) && (rc = pf.pin(pid, cursor.valuePage)) < 0) return rc;
+
+  Slot slot;
+  const char* page = cursor.valuePage.data();
+  memcpy(&slot, page + sizeof(SlottedHeader) + (sid - h.firstSid[n]) * sizeof(Slot), sizeof(slot));
+  value = page + slot.offset;
+  length = slot.length;
+  return 0;
+}
+
+void RecordFile::readInPlace(const char* page, int sid, int& key, const char*& value, int& length) const
+{
+  if (format == SLOTTED) {
+    Slot slot;
+    memcpy(&slot, page + sizeof(SlottedHeader) + sid * sizeof(Slot), sizeof(slot));
+    memcpy(&key, page + slot.offset, sizeof(int));
+    value = page + slot.offset + sizeof(int);
+    length = slot.length - sizeof(int);
+  } else if (format == COLUMNAR) {
+    // only the key is in a key page
+    memcpy(&key, page + sizeof(ColumnHeader) + sid * sizeof(int), sizeof(int));
+    value = NULL;
+    length = 0;
   } else {
-    // if this is the first slot of an empty page
-    // we can simply initialize the page with zeros
-    memset(page, 0, PageFile::PAGE_SIZE);
+    const char* ptr = slotPtr(const_cast<char*>(page), sid);
+    memcpy(&key, ptr, sizeof(int));
+    value = ptr + sizeof(int);
+    length = strnlen(value, MAX_VALUE_LENGTH);
+  }
+}
+
+RC RecordFile::prefetch(const RecordId* rids, int count) const
+{
+  vector<PageId> pids;
+
+  // PageFile::prefetch() reads a page only once even if several of the
+  // records are stored in it
+  for (int i = 0; i < count; i++) {
+    if (rids[i].pid >= 0 && rids[i].pid <= erid.pid) pids.push_back(rids[i].pid);
+  }
+  if (pids.empty()) return 0;
+  if (format != COLUMNAR) return pf.prefetch(&pids[0], pids.size());
+
+  // in the COLUMNAR format, the key pages tell which value pages hold
+  // the values, so they are read first
+  RC rc;
+  if ((rc = pf.prefetch(&pids[0], pids.size())) < 0) return rc;
+
+  vector<PageId> valuePids;
+  for (int i = 0; i < count; i++) {
+    PageHandle page;
+    if (rids[i].pid < 0 || rids[i].pid > erid.pid || pf.pin(rids[i].pid, page) < 0) continue;
+    ColumnHeader h = getColumnHeader(page.data());
+    int n = 0;
+    while (n + 1 < h.valuePages && h.firstSid[n + 1] <= rids[i].sid) n++;
+    valuePids.push_back(rids[i].pid + 1 + n);
+  }
+  if (valuePids.empty()) return 0;
+
+  return pf.prefetch(&valuePids[0], valuePids.size());
+}
+
+RC RecordFile::append(int key, const std::string& value, RecordId& rid)
+{
+  return appendBatch(&key, &value, 1, &rid);
+}
+
+RC RecordFile::appendBatch(const int* keys, const string* values, int count, RecordId* rids)
+{
+  RC         rc;
+  PageHandle page;
+
+  if (format == COLUMNAR) return appendColumnar(keys, values, count, rids);
+  if (format == COMPRESSED) return appendCompressed(keys, values, count, rids);
+
+  for (int i = 0; i < count; i++) {
+    // in the SLOTTED format, a record that does not fit in the space left
+    // in the last page starts a new page
+    if (format == SLOTTED && erid.sid > 0) {
+      if (!page.holds(pf, erid.pid) && (rc = pf.pinForWrite(erid.pid, page)) < 0) return rc;
+      if (!hasRoom(page.data(), values[i])) {
+        erid.pid++;
+        erid.sid = 0;
+      }
+    }
+
+    // pin the last page for writing. it stays pinned for the following
+    // records of the batch. if we are writing to the first slot of an
+    // empty page, the page starts out filled with zeros.
+    if (erid.sid == 0) {
+      if ((rc = startPage(erid.pid, page)) < 0) return rc;
+      if (format == SLOTTED) initSlotted(page.writableData(), pf.getPageSize());
+    } else if (!page.holds(pf, erid.pid) && (rc = pf.pinForWrite(erid.pid, page)) < 0) {
+      return rc;
+    }
+
+    // we need to output the rid of the record slot
+    rids[i] = erid;
+    if (zoneState == ZONES_VALID) addToZone(erid.pid, keys[i], values[i].c_str(), values[i].size());
+
+    if (format == SLOTTED) {
+      // the record goes after the last slot of the page
+      appendSlotted(page.writableData(), keys[i], values[i]);
+      erid.sid++;
+      continue;
+    }
+
+    // write the record to the first empty slot 
+    writeSlot(page.writableData(), erid.sid, keys[i], values[i]);
+
+    // the first four bytes in the page stores # records in the page.
+    // update this number.
+    setRecordCount(page.writableData(), erid.sid + 1);
+
+    // advance the end record id by one to the next empty slot
+    next(erid);
   }
-    
-  // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
 
-  // the first four bytes in the page stores # records in the page.
-  // update this number.
-  setRecordCount(page, erid.sid + 1);
+  return 0;
+}
 
-  // write the page to the disk
-  if ((rc = pf.write(erid.pid, page)) < 0) return rc;
-    
-  // we need to output the rid of the record slot
-  rid = erid;
+RC RecordFile::appendColumnar(const int* keys, const string* values, int count, RecordId* rids)
+{
+  RC         rc;
+  PageHandle keyPage;    // the last key page
+  PageHandle valuePage;  // the last value page of keyPage
+  ColumnHeader h;
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  for (int i = 0; i < count; i++) {
+    if (erid.sid > 0) {
+      if (!keyPage.holds(pf, erid.pid) && (rc = pf.pinForWrite(erid.pid, keyPage)) < 0) return rc;
+      h = getColumnHeader(keyPage.data());
+      PageId last = erid.pid + h.valuePages;
+      if (!valuePage.holds(pf, last) && (rc = pf.pinForWrite(last, valuePage)) < 0) return rc;
+
+      bool room = hasValueRoom(valuePage.data(), values[i]);
+      if (erid.sid >= keysPerPage(pf.getPageSize()) || (!room && h.valuePages == MAX_VALUE_PAGES)) {
+        // the key page is full. the next one goes after its value pages.
+        erid.pid = last + 1;
+        erid.sid = 0;
+      } else if (!room) {
+        // the value goes to a new value page after the last one
+        if ((rc = startPage(last + 1, valuePage)) < 0) return rc;
+        initSlotted(valuePage.writableData(), pf.getPageSize());
+        memcpy(valuePage.writableData(), &VALUES_MAGIC, sizeof(int));
+        h.firstSid[h.valuePages++] = erid.sid;
+        memcpy(keyPage.writableData(), &h, sizeof(h));
+      }
+    }
+
+    // a new key page starts with one empty value page
+    if (erid.sid == 0) {
+      if ((rc = startPage(erid.pid, keyPage)) < 0) return rc;
+      if ((rc = startPage(erid.pid + 1, valuePage)) < 0) return rc;
+      initSlotted(valuePage.writableData(), pf.getPageSize());
+      memcpy(valuePage.writableData(), &VALUES_MAGIC, sizeof(int));
+      memset(&h, 0, sizeof(h));
+      h.magic = KEYS_MAGIC;
+      h.valuePages = 1;
+      h.firstSid[0] = 0;
+    }
+
+    rids[i] = erid;
+    if (zoneState == ZONES_VALID) addToZone(erid.pid, keys[i], values[i].c_str(), values[i].size());
+
+    // the key goes after the last key, and the value to the value page
+    char* page = keyPage.writableData();
+    memcpy(page + sizeof(ColumnHeader) + erid.sid * sizeof(int), &keys[i], sizeof(int));
+    h.count = ++erid.sid;
+    memcpy(page, &h, sizeof(h));
+    appendValue(valuePage.writableData(), values[i]);
+  }
 
   return 0;
 }
 
+RC RecordFile::appendCompressed(const int* keys, const string* values, int count, RecordId* rids)
+{
+  RC         rc;
+  PageHandle page;
+  CompressedHeader h;
+  char       buffer[MAX_ENCODED_LENGTH];
+  int        pageSize = pf.getPageSize();
+  const std::string none;
+  bool       restart = true;  // whether the record is a restart point
+
+  for (int i = 0; i < count; i++) {
+    int length = 0;
+    if (erid.sid > 0) {
+      if (!page.holds(pf, erid.pid) && (rc = pf.pinForWrite(erid.pid, page)) < 0) return rc;
+      memcpy(&h, page.data(), sizeof(h));
+
+      // the last value of the page is decoded again after the file
+      // is opened
+      if (lastValuePid != erid.pid) {
+        int first;
+        int offset = findRestart(page.data(), pageSize, h.count - 1, first);
+        int key;
+        lastValue.clear();
+        for (int n = first; n < h.count; n++) decodeRecord(page.data(), h.baseKey, offset, key, lastValue);
+        lastValuePid = erid.pid;
+      }
+
+      // a record that does not fit with the offset of the restart
+      // points starts a new page
+      restart = (h.magic == COMPRESSED_MAGIC && erid.sid % RESTART_INTERVAL == 0);
+      length = encodeRecord(buffer, h.baseKey, keys[i], values[i], restart ? none : lastValue);
+      int restarts = getRestartCount(h) + (restart ? 1 : 0);
+      if (h.dataEnd + length > pageSize - restarts * (int)sizeof(int)) {
+        erid.pid++;
+        erid.sid = 0;
+      }
+    }
+
+    // the first record of a page sets its base key
+    if (erid.sid == 0) {
+      if ((rc = startPage(erid.pid, page)) < 0) return rc;
+      h.magic = COMPRESSED_MAGIC;
+      h.count = 0;
+      h.baseKey = keys[i];
+      h.dataEnd = sizeof(CompressedHeader);
+      lastValue.clear();
+      lastValuePid = erid.pid;
+      restart = true;
+      length = encodeRecord(buffer, h.baseKey, keys[i], values[i], lastValue);
+    }
+
+    rids[i] = erid;
+    if (zoneState == ZONES_VALID) addToZone(erid.pid, keys[i], values[i].c_str(), values[i].size());
+
+    if (restart) {
+      int n = erid.sid / RESTART_INTERVAL;
+      memcpy(page.writableData() + pageSize - (n + 1) * sizeof(int), &h.dataEnd, sizeof(int));
+    }
+    memcpy(page.writableData() + h.dataEnd, buffer, length);
+    h.dataEnd += length;
+    h.count = ++erid.sid;
+    memcpy(page.writableData(), &h, sizeof(h));
+    lastValue.assign(values[i], 0, RecordFile::MAX_VALUE_LENGTH - 1);
+  }
+
+  return 0;
+}
+
+RC RecordFile::startPage(PageId pid, PageHandle& page)
+{
+  RC rc;
+
+  // a new page that is still in the file is on the free list. the
+  // pages of a file emptied before clear() truncated it were freed from
+  // the last to the first, so the free list gives them back in order.
+  if (pid < pf.endPid()) {
+    PageId free;
+    if ((rc = pf.allocatePage(free)) < 0) return rc;
+    if (free != pid) return RC_INVALID_FILE_FORMAT;
+  }
+
+  if ((rc = pf.pinForWrite(pid, page)) < 0) return rc;
+  memset(page.writableData(), 0, pf.getPageSize());
+  return 0;
+}
+
+RC RecordFile::setFormat(Format newFormat)
+{
+  // the format of the pages cannot change once they hold records
+  if (erid.pid != 0 || erid.sid != 0) return (newFormat == format) ? 0 : RC_INVALID_FILE_FORMAT;
+  format = newFormat;
+  return 0;
+}
+
+RC RecordFile::clear()
+{
+  RC rc;
+
+  // every page of the file holds records, so the file is emptied
+  // instead of putting its pages on the free list
+  if ((rc = pf.truncate()) < 0) return rc;
+
+  erid.pid = 0;
+  erid.sid = 0;
+  lastValuePid = -1;
+
+  zones.clear();
+  resetStats();
+  zoneState = ZONES_VALID;
+  zonesDirty = true;
+  return 0;
+}
+
 const RecordId& RecordFile::endRid() const
 {
   return erid;
 }
 
+RecordId& RecordFile::next(RecordId& rid) const
+{
+  int count = recordsPerPage;
+
+  // a page in the SLOTTED and COLUMNAR formats ends after its last record
+  if (format != FIXED) {
+    count = (rid.pid == erid.pid) ? erid.sid : recordCount(rid.pid);
+  }
+
+  // if the end of a page is reached, move to the next page
+  if (++rid.sid >= count) {
+    rid.pid = nextPage(rid.pid);
+    rid.sid = 0;
+  }
+
+  return rid;
+}
+
+PageId RecordFile::nextPage(PageId pid, const char* page) const
+{
+  if (format != COLUMNAR) return pid + 1;
+
+  // the value pages of a key page come before the next key page
+  if (page) return pid + 1 + getColumnHeader(page).valuePages;
+  recordCount(pid);
+  return (pid == countPid) ? nextOfPid : pid + 1;
+}
+
+int RecordFile::recordCount(PageId pid) const
+{
+  PageHandle page;
+
+  // the page was usually just read by read()
+  if (pid == countPid) return countOfPid;
+  if (pf.pin(pid, page) < 0) return 0;
+  countPid = pid;
+  countOfPid = getSlottedCount(page.data());
+  nextOfPid = (format == COLUMNAR) ? nextPage(pid, page.data()) : pid + 1;
+  return countOfPid;
+}
+
+void RecordFile::addToZone(PageId pid, int key, const char* value, int length)
+{
+  char prefix[ZoneFilter::PREFIX_LENGTH];
+
+  // a new page starts with a zone that no record is in
+  while ((PageId)zones.size() <= pid) {
+    PageZone zone;
+    zone.minKey = INT_MAX;
+    zone.maxKey = INT_MIN;
+    memset(zone.minValue, 0xFF, sizeof(zone.minValue));
+    memset(zone.maxValue, 0, sizeof(zone.maxValue));
+    zones.push_back(zone);
+  }
+
+  if (stats.rowCount == 0) {
+    stats.minKey = key;
+    stats.maxKey = key;
+  }
+  stats.rowCount++;
+  stats.minKey = std::min(stats.minKey, key);
+  stats.maxKey = std::max(stats.maxKey, key);
+
+  PageZone& zone = zones[pid];
+  zone.minKey = std::min(zone.minKey, key);
+  zone.maxKey = std::max(zone.maxKey, key);
+  ZoneFilter::makePrefix(value, length, prefix);
+  if (memcmp(prefix, zone.minValue, sizeof(prefix)) < 0) memcpy(zone.minValue, prefix, sizeof(prefix));
+  if (memcmp(prefix, zone.maxValue, sizeof(prefix)) > 0) memcpy(zone.maxValue, prefix, sizeof(prefix));
+  zonesDirty = true;
+}
+
+RC RecordFile::getStats(TableStats& result) const
+{
+  if (zoneState == ZONES_UNREAD) readZones();
+  if (zoneState != ZONES_VALID) return RC_INVALID_FILE_FORMAT;
+
+  // the value pages of the COLUMNAR format have empty zones
+  result = stats;
+  result.pageCount = 0;
+  for (unsigned i = 0; i < zones.size(); i++) {
+    if (zones[i].minKey <= zones[i].maxKey) result.pageCount++;
+  }
+  return 0;
+}
+
+void RecordFile::resetStats() const
+{
+  stats.rowCount = 0;
+  stats.pageCount = 0;
+  stats.minKey = INT_MAX;
+  stats.maxKey = INT_MIN;
+}
+
+void RecordFile::readZones() const
+{
+  PageFile   zf;
+  ZoneHeader header;
+  char       page[PageFile::MAX_PAGE_SIZE];
+
+  zones.clear();
+  resetStats();
+  zoneState = ZONES_INVALID;
+
+  // a table without a zone map is scanned in full
+  if (zf.open(zoneName, 'r') < 0) return;
+
+  // the zone map is stale if the table changed after it was written
+  if (zf.read(0, page) < 0) { zf.close(); return; }
+  memcpy(&header, page, sizeof(header));
+  if (header.magic != ZONE_MAGIC || header.erid != erid || header.count < 0) {
+    zf.close();
+    return;
+  }
+
+  // the zones are packed in the pages after the header
+  int perPage = zf.getPageSize() / sizeof(PageZone);
+  zones.resize(header.count);
+  for (int i = 0; i < header.count; i += perPage) {
+    if (zf.read(1 + i / perPage, page) < 0) {
+      zones.clear();
+      zf.close();
+      return;
+    }
+    memcpy(&zones[i], page, std::min(perPage, header.count - i) * sizeof(PageZone));
+  }
+  zf.close();
+
+  stats.rowCount = header.rowCount;
+  stats.minKey = header.minKey;
+  stats.maxKey = header.maxKey;
+  zoneState = ZONES_VALID;
+}
+
+RC RecordFile::writeZones()
+{
+  RC         rc;
+  PageFile   zf;
+  ZoneHeader header;
+  char       page[PageFile::MAX_PAGE_SIZE];
+
+  if ((rc = zf.open(zoneName, 'w')) < 0) return rc;
+
+  int perPage = zf.getPageSize() / sizeof(PageZone);
+  for (int i = 0; i < (int)zones.size(); i += perPage) {
+    int n = std::min(perPage, (int)zones.size() - i);
+    memset(page, 0, zf.getPageSize());
+    memcpy(page, &zones[i], n * sizeof(PageZone));
+    if ((rc = zf.write(1 + i / perPage, page)) < 0) {
+      zf.close();
+      return rc;
+    }
+  }
+
+  // the header goes last, so that the zone map is valid only once all
+  // of its zones are written
+  memset(page, 0, zf.getPageSize());
+  header.magic = ZONE_MAGIC;
+  header.count = zones.size();
+  header.erid = erid;
+  header.rowCount = stats.rowCount;
+  header.minKey = stats.minKey;
+  header.maxKey = stats.maxKey;
+  memcpy(page, &header, sizeof(header));
+  if ((rc = zf.write(0, page)) < 0) {
+    zf.close();
+    return rc;
+  }
+
+  zonesDirty = false;
+  return zf.close();
+}
+
+RC RecordFile::rebuildZones()
+{
+  RC          rc;
+  ScanCursor  cursor;
+  int         key;
+  const char* value;
+  int         length;
+
+  // read every record of the table once
+  zones.clear();
+  resetStats();
+  zoneState = ZONES_VALID;
+  startScan(cursor);
+  while ((rc = readNext(cursor, key, value, length)) == 0) {
+    addToZone(cursor.rid.pid, key, value, length);
+  }
+  if (rc != RC_END_OF_FILE) {
+    zones.clear();
+    resetStats();
+    zoneState = ZONES_INVALID;
+    return rc;
+  }
+
+  zonesDirty = true;
+  return 0;
+}
+
+ZoneFilter::ZoneFilter()
+{
+  minKey = INT_MIN;
+  maxKey = INT_MAX;
+  hasMinValue = false;
+  hasMaxValue = false;
+}
+
+void ZoneFilter::restrictKeys(int min, int max)
+{
+  minKey = std::max(minKey, min);
+  maxKey = std::min(maxKey, max);
+}
+
+void ZoneFilter::restrictValues(const char* min, const char* max)
+{
+  char prefix[PREFIX_LENGTH];
+
+  if (min) {
+    makePrefix(min, strlen(min), prefix);
+    if (!hasMinValue || memcmp(prefix, minValue, PREFIX_LENGTH) > 0) memcpy(minValue, prefix, PREFIX_LENGTH);
+    hasMinValue = true;
+  }
+  if (max) {
+    makePrefix(max, strlen(max), prefix);
+    if (!hasMaxValue || memcmp(prefix, maxValue, PREFIX_LENGTH) < 0) memcpy(maxValue, prefix, PREFIX_LENGTH);
+    hasMaxValue = true;
+  }
+}
+
+bool ZoneFilter::matches(const PageZone& zone) const
+{
+  // a page without records has an empty zone
+  if (zone.minKey > zone.maxKey) return false;
+  if (zone.maxKey < minKey || zone.minKey > maxKey) return false;
+
+  // a value is at least as large as its prefix and smaller than the next
+  // prefix, so only a strictly smaller or larger prefix rules a page out
+  if (hasMinValue && memcmp(zone.maxValue, minValue, PREFIX_LENGTH) < 0) return false;
+  if (hasMaxValue && memcmp(zone.minValue, maxValue, PREFIX_LENGTH) > 0) return false;
+  return true;
+}
+
+void ZoneFilter::makePrefix(const char* value, int length, char* prefix)
+{
+  // shorter values are padded with NULs, which sort before any character
+  memset(prefix, 0, PREFIX_LENGTH);
+  memcpy(prefix, value, std::min(length, (int)PREFIX_LENGTH));
+}
+
 static int getRecordCount(const char* page)
 {
   int count;
@@ -276,3 +1154,229 @@ static void writeSlot(char* page, int n, int key, const std::string& value)
     strcpy(ptr + sizeof(int), value.c_str());
   }
 }
+
+static bool isSlotted(const char* page)
+{
+  int magic;
+  memcpy(&magic, page, sizeof(int));
+  return magic == SLOTTED_MAGIC;
+}
+
+static void initSlotted(char* page, int pageSize)
+{
+  SlottedHeader h;
+  h.magic = SLOTTED_MAGIC;
+  h.count = 0;
+  h.freeEnd = pageSize;
+  memcpy(page, &h, sizeof(h));
+}
+
+static int getSlottedCount(const char* page)
+{
+  SlottedHeader h;
+  memcpy(&h, page, sizeof(h));
+  return h.count;
+}
+
+// the length of the record with the value, truncated as in writeSlot()
+static int slottedLength(const std::string& value)
+{
+  int length = std::min((int)value.size(), RecordFile::MAX_VALUE_LENGTH - 1);
+  return sizeof(int) + length;
+}
+
+static bool hasRoom(const char* page, const std::string& value)
+{
+  SlottedHeader h;
+  memcpy(&h, page, sizeof(h));
+
+  // the new slot and the record must fit between the slot directory
+  // and the lowest record
+  int used = sizeof(SlottedHeader) + (h.count + 1) * sizeof(Slot);
+  return used + slottedLength(value) <= h.freeEnd;
+}
+
+static void readSlotted(const char* page, int n, int& key, std::string& value)
+{
+  Slot slot;
+
+  // find the record through the slot directory
+  memcpy(&slot, page + sizeof(SlottedHeader) + n * sizeof(Slot), sizeof(slot));
+  memcpy(&key, page + slot.offset, sizeof(int));
+  value.assign(page + slot.offset + sizeof(int), slot.length - sizeof(int));
+}
+
+static void appendSlotted(char* page, int key, const std::string& value)
+{
+  SlottedHeader h;
+  Slot          slot;
+
+  memcpy(&h, page, sizeof(h));
+
+  // store the record below the lowest record so far
+  slot.length = slottedLength(value);
+  slot.offset = h.freeEnd - slot.length;
+  memcpy(page + slot.offset, &key, sizeof(int));
+  memcpy(page + slot.offset + sizeof(int), value.data(), slot.length - sizeof(int));
+
+  // add its slot at the end of the directory
+  memcpy(page + sizeof(SlottedHeader) + h.count * sizeof(Slot), &slot, sizeof(slot));
+  h.count++;
+  h.freeEnd = slot.offset;
+  memcpy(page, &h, sizeof(h));
+}
+
+static bool isKeyPage(const char* page)
+{
+  int magic;
+  memcpy(&magic, page, sizeof(int));
+  return magic == KEYS_MAGIC;
+}
+
+static bool isValuePage(const char* page)
+{
+  int magic;
+  memcpy(&magic, page, sizeof(int));
+  return magic == VALUES_MAGIC;
+}
+
+static int keysPerPage(int pageSize)
+{
+  return (pageSize - sizeof(ColumnHeader)) / sizeof(int);
+}
+
+static ColumnHeader getColumnHeader(const char* page)
+{
+  ColumnHeader h;
+  memcpy(&h, page, sizeof(h));
+  return h;
+}
+
+static bool hasValueRoom(const char* page, const std::string& value)
+{
+  SlottedHeader h;
+  memcpy(&h, page, sizeof(h));
+
+  // the value is truncated as in writeSlot()
+  int length = std::min((int)value.size(), RecordFile::MAX_VALUE_LENGTH - 1);
+  int used = sizeof(SlottedHeader) + (h.count + 1) * sizeof(Slot);
+  return used + length <= h.freeEnd;
+}
+
+static void appendValue(char* page, const std::string& value)
+{
+  SlottedHeader h;
+  Slot          slot;
+
+  memcpy(&h, page, sizeof(h));
+
+  // store the value below the lowest value so far
+  slot.length = std::min((int)value.size(), RecordFile::MAX_VALUE_LENGTH - 1);
+  slot.offset = h.freeEnd - slot.length;
+  memcpy(page + slot.offset, value.data(), slot.length);
+
+  // add its slot at the end of the directory
+  memcpy(page + sizeof(SlottedHeader) + h.count * sizeof(Slot), &slot, sizeof(slot));
+  h.count++;
+  h.freeEnd = slot.offset;
+  memcpy(page, &h, sizeof(h));
+}
+
+static bool isCompressed(const char* page)
+{
+  int magic;
+  memcpy(&magic, page, sizeof(int));
+  return magic == COMPRESSED_MAGIC || magic == OLD_COMPRESSED_MAGIC;
+}
+
+// store n in 7 bits per byte, lowest first. the high bit of a byte is
+// set if more bytes follow. returns # bytes used.
+static int putVarint(char* buffer, unsigned long long n)
+{
+  int length = 0;
+  while (n >= 0x80) {
+    buffer[length++] = (char)(n | 0x80);
+    n >>= 7;
+  }
+  buffer[length++] = (char)n;
+  return length;
+}
+
+static unsigned long long getVarint(const char* page, int& offset)
+{
+  // most lengths take one byte
+  if (!(page[offset] & 0x80)) return (unsigned char)page[offset++];
+
+  unsigned long long n = 0;
+  int shift = 0;
+  unsigned char c;
+  do {
+    c = page[offset++];
+    n |= (unsigned long long)(c & 0x7f) << shift;
+    shift += 7;
+  } while (c & 0x80);
+  return n;
+}
+
+static int encodeRecord(char* buffer, int baseKey, int key, const std::string& value,
+                        const std::string& prev)
+{
+  // the difference from the base key is small if the keys of the page are
+  // close, and zigzag encoding makes a small negative difference small too
+  long long delta = (long long)key - baseKey;
+  unsigned long long zigzag = (delta < 0) ? ((unsigned long long)(-delta) << 1) - 1
+                                          : (unsigned long long)delta << 1;
+  int length = putVarint(buffer, zigzag);
+
+  // the value is truncated as in writeSlot()
+  int size = std::min((int)value.size(), RecordFile::MAX_VALUE_LENGTH - 1);
+  int shared = 0;
+  while (shared < size && shared < (int)prev.size() && value[shared] == prev[shared]) shared++;
+  length += putVarint(buffer + length, shared);
+  length += putVarint(buffer + length, size - shared);
+  memcpy(buffer + length, value.data() + shared, size - shared);
+  return length + size - shared;
+}
+
+static void decodeRecord(const char* page, int baseKey, int& offset, int& key, std::string& value)
+{
+  unsigned long long zigzag = getVarint(page, offset);
+  long long delta = (zigzag & 1) ? -(long long)(zigzag >> 1) - 1 : (long long)(zigzag >> 1);
+  key = (int)(baseKey + delta);
+
+  // the shared prefix is already in value
+  int shared = getVarint(page, offset);
+  int rest = getVarint(page, offset);
+  value.resize(shared + rest);
+  memcpy(&value[shared], page + offset, rest);
+  offset += rest;
+}
+
+static int getBaseKey(const char* page)
+{
+  CompressedHeader h;
+  memcpy(&h, page, sizeof(h));
+  return h.baseKey;
+}
+
+static int getRestartCount(const CompressedHeader& h)
+{
+  if (h.magic != COMPRESSED_MAGIC) return 0;
+  return (h.count + RESTART_INTERVAL - 1) / RESTART_INTERVAL;
+}
+
+static int findRestart(const char* page, int pageSize, int sid, int& first)
+{
+  CompressedHeader h;
+  memcpy(&h, page, sizeof(h));
+  if (h.magic != COMPRESSED_MAGIC || sid < 0) {
+    first = 0;
+    return sizeof(CompressedHeader);
+  }
+
+  int n = sid / RESTART_INTERVAL;
+  int offset;
+  memcpy(&offset, page + pageSize - (n + 1) * sizeof(int), sizeof(int));
+  first = n * RESTART_INTERVAL;
+  return offset;
+}
@@ -11,6 +11,7 @@
 #define RECORDFILE_H
 
 #include <string>
+#include <vector>
 #include "PageFile.h"
 
 /**
@@ -26,7 +27,9 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
+// RecordId iterators.
+// these assume pages of the default size (RecordFile::RECORDS_PER_PAGE slots).
+// use RecordFile::next() to step through the records of a RecordFile.
 RecordId& operator++ (RecordId& rid);
 RecordId  operator++ (RecordId& rid, int);
 
@@ -38,6 +41,98 @@ bool operator<= (const RecordId& r1, const RecordId& r2);
 bool operator== (const RecordId& r1, const RecordId& r2);
 bool operator!= (const RecordId& r1, const RecordId& r2);
 
+/**
+ * The zone of a page of a RecordFile: the smallest and largest key and
+ * value prefix of the records in the page. the zones of a table are kept
+ * in a zone map next to it, so that a scan can skip the pages that hold
+ * no record it wants without reading them.
+ */
+struct PageZone {
+  int  minKey;       // the smallest key in the page
+  int  maxKey;       // the largest key in the page
+  char minValue[8];  // the smallest value prefix in the page
+  char maxValue[8];  // the largest value prefix in the page
+};
+
+/**
+ * The keys and values a scan wants, as ranges that pages are checked
+ * against with their zones. a page whose zone lies outside the ranges
+ * cannot hold a wanted record; other pages are read as usual, so the
+ * conditions must still be checked on the records.
+ */
+struct ZoneFilter {
+  static const int PREFIX_LENGTH = 8;  // # value characters a zone keeps
+
+  int  minKey;       // the smallest key wanted
+  int  maxKey;       // the largest key wanted
+  bool hasMinValue;  // true if minValue bounds the values
+  bool hasMaxValue;  // true if maxValue bounds the values
+  char minValue[PREFIX_LENGTH];  // the prefix of the smallest value wanted
+  char maxValue[PREFIX_LENGTH];  // the prefix of the largest value wanted
+
+  /**
+   * a filter that wants every record.
+   */
+  ZoneFilter();
+
+  /**
+   * want only the keys in [min, max] from now on.
+   * @param min[IN] the smallest key wanted
+   * @param max[IN] the largest key wanted
+   */
+  void restrictKeys(int min, int max);
+
+  /**
+   * want only the values in [min, max] from now on.
+   * @param min[IN] the smallest value wanted, NULL for no bound
+   * @param max[IN] the largest value wanted, NULL for no bound
+   */
+  void restrictValues(const char* min, const char* max);
+
+  /**
+   * @param zone[IN] the zone of a page
+   * @return false if no record in the page can be wanted
+   */
+  bool matches(const PageZone& zone) const;
+
+  /**
+   * compute the prefix of a value that zones keep, padded with NULs.
+   * @param value[IN] the characters of the value
+   * @param length[IN] # characters in value
+   * @param prefix[OUT] PREFIX_LENGTH bytes
+   */
+  static void makePrefix(const char* value, int length, char* prefix);
+};
+
+/**
+ * The statistics of a whole RecordFile, kept in its zone map so that
+ * they can be read without scanning the records.
+ */
+struct TableStats {
+  int rowCount;   // # records in the file
+  int pageCount;  // # pages holding records (key pages if COLUMNAR)
+  int minKey;     // the smallest key, INT_MAX if there are no records
+  int maxKey;     // the largest key, INT_MIN if there are no records
+};
+
+/**
+ * The position of a scan over the records of a RecordFile.
+ * the page of the next record stays pinned while its records are read,
+ * so values can be handed out in place. see RecordFile::readNext().
+ */
+struct ScanCursor {
+  RecordId   rid;    // the next record to read
+  PageHandle page;   // the pinned page of rid, empty before the first read
+  PageHandle valuePage;  // the pinned value page in the COLUMNAR format
+  int        count;  // # records in the pinned page
+  const ZoneFilter* filter;  // the pages to skip, NULL to read every page
+  bool       keysOnly;  // true if readNext() need not read the values
+  PageId     prefetchEnd;  // the page after those read ahead so far
+  int        offset;  // the next record of a COMPRESSED page
+  int        baseKey; // the base key of the COMPRESSED page
+  std::string buffer; // the last value decoded from a COMPRESSED page
+};
+
 /**
  * read/write a record to a file
  */
@@ -47,11 +142,40 @@ class RecordFile {
   // maximum length of the value field
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
+  /**
+   * the layout of the records in the pages of a file.
+   * FIXED: every record takes a slot of sizeof(int) + MAX_VALUE_LENGTH
+   *   bytes, and the first four bytes of a page hold # records in it.
+   *   files created by older versions are in this format.
+   * SLOTTED: a page starts with a header and a directory of slots that
+   *   point to the records, which are stored from the end of the page
+   *   down and take only the length of their value. new files are
+   *   created in this format.
+   * COMPRESSED: the records of a page are encoded back to back without
+   *   a slot directory. a key is stored as a varint of its difference
+   *   from the first key of the page, and a value as the characters that
+   *   follow its common prefix with the previous value (front coding).
+   *   every 16th value is stored whole, and the offsets of those records
+   *   are kept at the end of the page, so a record is decoded from the
+   *   one of them before it. created by LOAD ... AS COMPRESSED.
+   * COLUMNAR: the keys and the values are stored in separate pages. a
+   *   key page holds only keys, and is followed by the value pages that
+   *   hold the values of its records in the same order, so a scan of the
+   *   keys reads only the key pages. records are identified by their
+   *   key page and position in it. created by LOAD ... AS COLUMNAR.
+   * a record is identified by its page and slot number in all formats.
+   */
+  enum Format { FIXED, SLOTTED, COLUMNAR, COMPRESSED };
+
+  // number of record slots per page of the default size in the FIXED format
   static const int RECORDS_PER_PAGE = (PageFile::PAGE_SIZE - sizeof(int))/ (sizeof(int) + MAX_VALUE_LENGTH);  
     // Note that we subtract sizeof(int) from PAGE_SIZE because the first
     // four bytes in the page is used to store # records in the page.
 
+  // number of record slots in a page of pageSize bytes in the FIXED format
+  static constexpr int slotsPerPage(int pageSize)
+    { return (pageSize - sizeof(int)) / (sizeof(int) + MAX_VALUE_LENGTH); }
+
   RecordFile();
   RecordFile(const std::string& filename, char mode);
   
@@ -79,6 +203,62 @@ class RecordFile {
    */
   RC read(const RecordId& rid, int& key, std::string& value) const;
 
+  /**
+   * position a cursor at the first record of the file.
+   * with a filter, the scan skips the pages whose zone shows that they
+   * hold no wanted record. the filter must outlive the scan.
+   * a scan of the keys only may not read the values of the records, so
+   * that readNext() returns a NULL value; readValue() then reads the
+   * value of a record.
+   * @param cursor[OUT] the cursor to start a scan with
+   * @param filter[IN] the records wanted, NULL for all
+   * @param keysOnly[IN] true if the values are not needed
+   */
+  void startScan(ScanCursor& cursor, const ZoneFilter* filter = 0, bool keysOnly = false) const;
+
+  /**
+   * read the record at the cursor and move the cursor to the next record.
+   * each page is pinned once for all of its records, and the value is not
+   * copied: it points into the pinned page and stays valid until the
+   * cursor moves to the next page or is destroyed. in the COMPRESSED
+   * format, the value is decoded into the cursor and stays valid only
+   * until the next call.
+   * @param cursor[IN/OUT] the cursor set by startScan()
+   * @param key[OUT] the record key
+   * @param value[OUT] the characters of the value, not NUL-terminated
+   * @param length[OUT] # characters in value
+   * @return error code. RC_END_OF_FILE after the last record
+   */
+  RC readNext(ScanCursor& cursor, int& key, const char*& value, int& length) const;
+
+  /**
+   * read the value of the record last read by readNext(), in place.
+   * the value stays valid as with readNext().
+   * @param cursor[IN/OUT] the cursor of the scan
+   * @param value[OUT] the characters of the value, not NUL-terminated
+   * @param length[OUT] # characters in value
+   * @return error code. 0 if no error
+   */
+  RC readValue(ScanCursor& cursor, const char*& value, int& length) const;
+
+  /**
+   * read the pages holding a set of records into the buffer pool with one
+   * batch of disk reads, so that reading the records later does not block
+   * on the disk one page at a time.
+   * @param rids[IN] the ids of the records that will be read
+   * @param count[IN] # record ids in rids
+   * @return error code. 0 if no error
+   */
+  RC prefetch(const RecordId* rids, int count) const;
+
+  /**
+   * announce that the records are about to be read in rid order (or that
+   * such a scan is over), so that their pages are read ahead in large
+   * chunks. see PageFile::setSequential().
+   * @param on[IN] true before a sequential scan, false after it
+   */
+  void setSequential(bool on) { pf.setSequential(on); }
+
   /**
    * append a new record at the end of the file.
    * note that RecordFile does not have write() function.
@@ -90,15 +270,184 @@ class RecordFile {
    */
   RC append(int key, const std::string& value, RecordId& rid);
 
+  /**
+   * append many records at the end of the file, in order. each page is
+   * pinned once and filled in place, instead of once per record.
+   * if an error occurs, the records before the failed one are appended.
+   * @param keys[IN] the record keys
+   * @param values[IN] the record values
+   * @param count[IN] # records to append
+   * @param rids[OUT] the locations of the stored records, count of them
+   * @return error code. 0 if no error
+   */
+  RC appendBatch(const int* keys, const std::string* values, int count, RecordId* rids);
+
+  /**
+   * remove all records. the file is truncated to its header, so a later
+   * load starts at page 0 and finds no trailing free pages.
+   * @return error code. 0 if no error
+   */
+  RC clear();
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the RecordFile
    */
   const RecordId& endRid() const;
 
+  /**
+   * advance rid to the next record slot of the file.
+   * @param rid[IN/OUT] the record id to advance
+   * @return rid
+   */
+  RecordId& next(RecordId& rid) const;
+
+  /**
+   * @return the number of record slots in a page of the file in the
+   *         FIXED format. in the SLOTTED format, the number of records
+   *         in a page depends on their length.
+   */
+  int getRecordsPerPage() const { return recordsPerPage; }
+
+  /**
+   * @return the format of the pages of the file
+   */
+  Format getFormat() const { return format; }
+
+  /**
+   * choose the format of the pages of an empty file.
+   * @param format[IN] the format the records are appended in
+   * @return error code. RC_INVALID_FILE_FORMAT if the file has records
+   *         in another format
+   */
+  RC setFormat(Format format);
+
+  /**
+   * get the statistics of the file from its zone map, without reading
+   * the records. they are unavailable if the zone map is missing or was
+   * not updated by the last writer of the file.
+   * @param stats[OUT] the statistics of the file
+   * @return error code. RC_INVALID_FILE_FORMAT if the statistics
+   *         are unavailable
+   */
+  RC getStats(TableStats& stats) const;
+
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int      recordsPerPage; // # record slots in a page of the file
+  Format   format; // the format of the pages of the file
+
+  // # records in the page last read. next() uses it to find the end of
+  // a page in the SLOTTED format without pinning the page again.
+  mutable PageId countPid;
+  mutable int    countOfPid;
+  mutable PageId nextOfPid;  // the page after the records of countPid
+
+  // the last value appended to page lastValuePid in the COMPRESSED
+  // format, which the next value of the page is encoded against
+  std::string lastValue;
+  PageId      lastValuePid;
+
+  // the zone map of the file. it is stored in the file named zoneName,
+  // whose first page holds a ZoneHeader and the rest the zones of the
+  // pages in order. the map is valid only if the table ended at the same
+  // record id when it was written; a stale map is ignored by readers and
+  // rebuilt when the table is opened for writing.
+  static const int ZONE_MAGIC = 0x324e4f5a;
+  struct ZoneHeader {
+    int      magic;  // ZONE_MAGIC
+    int      count;  // # zones in the map
+    RecordId erid;   // the end record id of the table the map describes
+    int      rowCount; // # records in the table
+    int      minKey;   // the smallest key in the table
+    int      maxKey;   // the largest key in the table
+  };
+  enum ZoneState { ZONES_UNREAD, ZONES_VALID, ZONES_INVALID };
+
+  std::string zoneName;                // the file of the zone map
+  mutable std::vector<PageZone> zones; // the zone of each page
+  mutable ZoneState zoneState;         // whether zones can be used
+  mutable TableStats stats;            // the statistics of the records zones cover
+  bool zonesDirty;                     // true if zones changed since read
+
+  /**
+   * @return # records in page pid of a SLOTTED file
+   */
+  int recordCount(PageId pid) const;
+
+  /**
+   * set erid from the pages of the file, and the format of the file.
+   * @return error code. 0 if no error
+   */
+  RC findEnd();
+
+  /**
+   * @param pid[IN] a page with records
+   * @param page[IN] the data of the page if it is pinned, or NULL
+   * @return the next page with records: the next key page after the
+   *         value pages of pid in the COLUMNAR format, pid + 1 otherwise
+   */
+  PageId nextPage(PageId pid, const char* page = 0) const;
+
+  /**
+   * read the record in a slot of a pinned page without copying it.
+   * the value of a record in the COLUMNAR format is not in the page and
+   * is returned as NULL.
+   */
+  void readInPlace(const char* page, int sid, int& key, const char*& value, int& length) const;
+
+  /**
+   * appendBatch() for the COLUMNAR format.
+   */
+  RC appendColumnar(const int* keys, const std::string* values, int count, RecordId* rids);
+
+  /**
+   * appendBatch() for the COMPRESSED format.
+   */
+  RC appendCompressed(const int* keys, const std::string* values, int count, RecordId* rids);
+
+  /**
+   * pin a new page at the end of the records for writing, taking it from
+   * the free list if it is on it, and fill it with zeros.
+   * @param pid[IN] the page to start
+   * @param page[OUT] the handle that pins the page
+   * @return error code. 0 if no error
+   */
+  RC startPage(PageId pid, PageHandle& page);
+
+  /**
+   * widen the zone of a page and the statistics of the file to include
+   * a record.
+   * @param pid[IN] the page of the record
+   * @param key[IN] the record key
+   * @param value[IN] the characters of the record value
+   * @param length[IN] # characters in value
+   */
+  void addToZone(PageId pid, int key, const char* value, int length);
+
+  /**
+   * set stats to those of a file without records.
+   */
+  void resetStats() const;
+
+  /**
+   * read the zone map of the file into zones and stats, if it exists and
+   * is valid.
+   */
+  void readZones() const;
+
+  /**
+   * write zones and stats to the zone map of the file.
+   * @return error code. 0 if no error
+   */
+  RC writeZones();
+
+  /**
+   * compute zones and stats from the records of the file.
+   * @return error code. 0 if no error
+   */
+  RC rebuildZones();
 };
 
 #endif // RECORDFILE_H
@@ -7,15 +7,20 @@
  * @date 3/24/2008
  */
 
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
 #include <iostream>
 #include <fstream>
+#include <queue>
+#include <unistd.h>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 
 #include "BTreeIndex.h"
+#include "PageFile.h"
 
 using namespace std;
 
@@ -23,6 +28,74 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+char SqlEngine::readMode = 'r';
+int  SqlEngine::indexFill = BTreeIndex::DEFAULT_FILL;
+vector<IOStats> SqlEngine::queryStart;
+vector<IOStats> SqlEngine::lastQuery;
+
+// # index entries whose records are read from the disk in one batch
+static const int PREFETCH_BATCH = 64;
+
+// read the pages of the records of the next PREFETCH_BATCH index entries
+// (up to the key maxKey) into the buffer pool with one batch of disk reads.
+// the cursor is copied, so the scan itself is not moved.
+// returns # index entries covered by the batch.
+static int prefetchRecords(BTreeIndex& btree, IndexCursor cursor,
+                           const RecordFile& rf, int maxKey);
+
+// compare a value read in place by a table scan with a NUL-terminated
+// string, like strcmp()
+static int compareValue(const char* value, int length, const char* s);
+
+// set the ranges of keys and values that the conditions of a SELECT allow,
+// so that a table scan can skip the pages outside of them
+static void setZoneFilter(const vector<SelCond>& cond, ZoneFilter& filter);
+
+// order index entries by key only, so that a stable sort keeps the
+// entries of equal keys in the order of their tuples
+static bool entryKeyLess(const IndexEntry& e1, const IndexEntry& e2);
+
+// # index entries LOAD sorts in memory at once (4MB)
+static const int SORT_RUN_ENTRIES = (4 << 20) / sizeof(IndexEntry);
+
+// # index entries read at once from each sorted run while they are merged
+static const int MERGE_READ_ENTRIES = 4096;
+
+// sorts the index entries of a LOAD by key in a bounded amount of memory.
+// the entries are sorted in runs of SORT_RUN_ENTRIES, which are written
+// to a temporary file once there is more than one, and then merged into
+// the bulk load of the index. equal keys keep the order they are added in.
+class EntrySorter {
+ public:
+  EntrySorter() : spill(NULL) {}
+  ~EntrySorter() { if (spill != NULL) fclose(spill); }
+
+  // add an entry
+  RC add(int key, const RecordId& rid);
+
+  // give every entry in key order to tree.bulkAdd()
+  RC build(BTreeIndex& tree);
+
+ private:
+  // a sorted run in the temporary file, and the part of it being merged
+  struct Run {
+    off_t next;                // the file offset of the next entries to read
+    off_t end;                 // the file offset of the end of the run
+    std::vector<IndexEntry> buffer;
+    unsigned pos;              // the next entry of buffer to merge
+  };
+
+  // sort the entries and write them to the temporary file as a new run
+  RC spillRun();
+
+  // read the next entries of a run into its buffer
+  RC fillRun(Run& run);
+
+  std::vector<IndexEntry> entries;  // the entries not in a run yet
+  std::vector<Run> runs;            // the runs in the temporary file
+  FILE* spill;                      // the temporary file
+};
+
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -39,20 +112,23 @@ RC SqlEngine::run(FILE* commandline)
 RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 {
   RecordFile rf;   // RecordFile containing the table
-  RecordId   rid;  // record cursor for table scanning
+  ScanCursor scan; // record cursor for table scanning
+  ZoneFilter zoneFilter; // the pages the table scan must read
+  TableStats stats;      // the statistics of the table
 
   BTreeIndex btree;
   IndexCursor cursor;
 
   RC     rc;
   int    key;     
-  string value;
+  const char* scanValue;  // the value of a tuple in a table scan, in place
+  int    length;          // # characters in scanValue
   int    count;
   int    diff;
   count = 0;
 
   // open the table file
-  if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+  if ((rc = rf.open(table + ".tbl", readMode)) < 0) {
     fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
     return rc;
   }
@@ -290,14 +366,25 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 
   // END SELECT CONDITION LOGIC
 
-  if(btree.open(table + ".idx", 'r') || (!hasIDXcond && attr != 4)) // no index condition or count(*) because count(*) likes b+ tree when there are key conditions
+  // the number of tuples of the table is kept in its statistics
+  if (attr == 4 && cond.empty() && rf.getStats(stats) == 0) {
+    count = stats.rowCount;
+    goto bad_condition_count;
+  }
+
+  if(btree.open(table + ".idx", readMode) || (!hasIDXcond && attr != 4)) // no index condition or count(*) because count(*) likes b+ tree when there are key conditions
   {
-    // scan the table file from the beginning
-  rid.pid = rid.sid = 0;
+    // scan the table file from the beginning, a page at a time.
+    // the values are read only when a condition or the output needs them,
+    // and reading ahead would bring in the value pages that a scan of the
+    // keys of a COLUMNAR table skips.
+  setZoneFilter(cond, zoneFilter);
+  rf.startScan(scan, &zoneFilter, !valCond);
+  rf.setSequential(valCond || rf.getFormat() != RecordFile::COLUMNAR);
   
-  while (rid < rf.endRid()) {
+  while ((rc = rf.readNext(scan, key, scanValue, length)) != RC_END_OF_FILE) {
     // read the tuple
-    if ((rc = rf.read(rid, key, value)) < 0) 
+    if (rc < 0) 
     {
       fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
       goto exit_select;
@@ -313,7 +400,7 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
           diff = key - atoi(cond[i].value);
           break;
         case 2:
-          diff = strcmp(value.c_str(), cond[i].value);
+          diff = compareValue(scanValue, length, cond[i].value);
           break;
       }
 
@@ -345,6 +432,12 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
     // increase matching tuple counter
     count++;
 
+    if ((attr == 2 || attr == 3) && !valCond && (rc = rf.readValue(scan, scanValue, length)) < 0)
+    {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      goto exit_select;
+    }
+
     // print the tuple 
     switch (attr) 
     {
@@ -352,16 +445,16 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
         fprintf(stdout, "%d\n", key);
         break;
       case 2:  // SELECT value
-        fprintf(stdout, "%s\n", value.c_str());
+        fprintf(stdout, "%.*s\n", length, scanValue);
         break;
       case 3:  // SELECT *
-        fprintf(stdout, "%d '%s'\n", key, value.c_str());
+        fprintf(stdout, "%d '%.*s'\n", key, length, scanValue);
         break;
     }
 
     // move to the next tuple
     next_tuple:
-    ++rid;
+    ;
   }
 
   }
@@ -404,9 +497,17 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
         // check against conditions, break out if any fail
         // if none fail, increment count
         // print tuple
+    // when the records have to be read, their pages are read ahead in
+    // batches so that the disk sees many reads at once
+    int untilPrefetch = 0;
+    int maxKey = (keyMustEqual != -9999) ? keyMustEqual :
+                 (maxRange != -9999) ? maxRange : 0x7fffffff;
     while(true) {
       next_rid:
 
+      if ((valCond || attr != 4) && --untilPrefetch <= 0)
+        untilPrefetch = prefetchRecords(btree, cursor, rf, maxKey);
+
       int key;
       RecordId rid;
       error = btree.readForward(cursor, key, rid);
@@ -544,8 +645,166 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
   return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+static int prefetchRecords(BTreeIndex& btree, IndexCursor cursor,
+                           const RecordFile& rf, int maxKey)
 {
+  RecordId rids[PREFETCH_BATCH];
+  int      key;
+  int      n;
+
+  for (n = 0; n < PREFETCH_BATCH; n++) {
+    if (btree.readForward(cursor, key, rids[n]) != 0 || key > maxKey) break;
+  }
+  rf.prefetch(rids, n);
+
+  return PREFETCH_BATCH;
+}
+
+static void setZoneFilter(const vector<SelCond>& cond, ZoneFilter& filter)
+{
+  for (unsigned i = 0; i < cond.size(); i++) {
+    if (cond[i].attr == 1) {
+      int k = atoi(cond[i].value);
+      switch (cond[i].comp) {
+      case SelCond::EQ:
+        filter.restrictKeys(k, k);
+        break;
+      case SelCond::GT:
+        if (k == INT_MAX) filter.restrictKeys(INT_MAX, INT_MIN);
+        else filter.restrictKeys(k + 1, INT_MAX);
+        break;
+      case SelCond::GE:
+        filter.restrictKeys(k, INT_MAX);
+        break;
+      case SelCond::LT:
+        if (k == INT_MIN) filter.restrictKeys(INT_MAX, INT_MIN);
+        else filter.restrictKeys(INT_MIN, k - 1);
+        break;
+      case SelCond::LE:
+        filter.restrictKeys(INT_MIN, k);
+        break;
+      default:
+        break;
+      }
+    } else if (cond[i].attr == 2) {
+      switch (cond[i].comp) {
+      case SelCond::EQ:
+        filter.restrictValues(cond[i].value, cond[i].value);
+        break;
+      case SelCond::GT:
+      case SelCond::GE:
+        filter.restrictValues(cond[i].value, NULL);
+        break;
+      case SelCond::LT:
+      case SelCond::LE:
+        filter.restrictValues(NULL, cond[i].value);
+        break;
+      default:
+        break;
+      }
+    }
+  }
+}
+
+static int compareValue(const char* value, int length, const char* s)
+{
+  // the value has no NUL, so it is smaller if s goes on after it
+  int diff = strncmp(value, s, length);
+  if (diff != 0) return diff;
+  return (s[length] == 0) ? 0 : -1;
+}
+
+static bool entryKeyLess(const IndexEntry& e1, const IndexEntry& e2)
+{
+  return e1.key < e2.key;
+}
+
+RC EntrySorter::add(int key, const RecordId& rid)
+{
+  IndexEntry entry = { key, rid };
+  entries.push_back(entry);
+  return ((int)entries.size() == SORT_RUN_ENTRIES) ? spillRun() : 0;
+}
+
+RC EntrySorter::build(BTreeIndex& tree)
+{
+  RC rc;
+
+  // the entries fit in memory
+  if (runs.empty()) {
+    stable_sort(entries.begin(), entries.end(), entryKeyLess);
+    for (unsigned i = 0; i < entries.size(); i++) {
+      if ((rc = tree.bulkAdd(entries[i].key, entries[i].rid)) < 0) return rc;
+    }
+    return 0;
+  }
+
+  if (!entries.empty() && (rc = spillRun()) < 0) return rc;
+  std::vector<IndexEntry>().swap(entries);
+  if (fflush(spill) != 0) return RC_FILE_WRITE_FAILED;
+
+  // merge the runs, taking the smallest key of their next entries. equal
+  // keys are taken from the earlier run first.
+  typedef std::pair<int, int> Head;  // (key, run)
+  std::priority_queue<Head, std::vector<Head>, std::greater<Head> > heads;
+  for (unsigned r = 0; r < runs.size(); r++) {
+    if ((rc = fillRun(runs[r])) < 0) return rc;
+    heads.push(Head(runs[r].buffer[0].key, r));
+  }
+  while (!heads.empty()) {
+    int r = heads.top().second;
+    Run& run = runs[r];
+    heads.pop();
+    const IndexEntry& entry = run.buffer[run.pos++];
+    if ((rc = tree.bulkAdd(entry.key, entry.rid)) < 0) return rc;
+    if (run.pos == run.buffer.size() && (rc = fillRun(run)) < 0) return rc;
+    if (run.pos < run.buffer.size()) {
+      heads.push(Head(run.buffer[run.pos].key, r));
+    }
+  }
+  return 0;
+}
+
+RC EntrySorter::spillRun()
+{
+  if (spill == NULL && (spill = tmpfile()) == NULL) return RC_FILE_OPEN_FAILED;
+
+  stable_sort(entries.begin(), entries.end(), entryKeyLess);
+  if (fwrite(&entries[0], sizeof(IndexEntry), entries.size(), spill) != entries.size()) {
+    return RC_FILE_WRITE_FAILED;
+  }
+
+  Run run;
+  run.next = runs.empty() ? 0 : runs.back().end;
+  run.end = run.next + (off_t)(entries.size() * sizeof(IndexEntry));
+  run.pos = 0;
+  runs.push_back(run);
+  entries.clear();
+  return 0;
+}
+
+RC EntrySorter::fillRun(Run& run)
+{
+  off_t left = (run.end - run.next) / sizeof(IndexEntry);
+  size_t count = (left < MERGE_READ_ENTRIES) ? left : MERGE_READ_ENTRIES;
+  size_t size = count * sizeof(IndexEntry);
+
+  run.buffer.resize(count);
+  run.pos = 0;
+  if (count > 0 && pread(fileno(spill), &run.buffer[0], size, run.next) != (ssize_t)size) {
+    return RC_FILE_READ_FAILED;
+  }
+  run.next += size;
+  return 0;
+}
+
+RC SqlEngine::load(const string& table, const string& loadfile, bool index,
+                   RecordFile::Format format)
+{
+  // the warm-up thread may still be reading pages of the file we are
+  // about to recreate. let it finish so no stale page is cached.
+  PageFile::waitWarmUp();
+
   ifstream l_file;
   l_file.open(loadfile.c_str());
   RC error;
@@ -556,6 +815,12 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
     l_file.close();
     return error;
   }
+  if(format != RecordFile::SLOTTED && (error = rf.setFormat(format)) != 0) {
+    fprintf(stderr, "Error: table %s already has tuples in another format\n", table.c_str());
+    rf.close();
+    l_file.close();
+    return error;
+  }
 
   BTreeIndex tree;
   if(index) {
@@ -567,36 +832,73 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
       return error;
     }
   }
+  // the tuples are appended LOAD_BATCH at a time, so that each page of
+  // the table is filled in place at once
   string line;
-  while(getline(l_file, line)) {
-    int key;
-    string value;
-    error = parseLoadLine(line, key, value);
+  vector<int> keys;
+  vector<string> values;
+  vector<RecordId> rids(LOAD_BATCH);
+  EntrySorter entries;  // the index entries of the tuples
+  RC parseError = 0;
+  do {
+    keys.clear();
+    values.clear();
+    while((int)keys.size() < LOAD_BATCH && getline(l_file, line)) {
+      int key;
+      string value;
+      parseError = parseLoadLine(line, key, value);
+      if(parseError != 0) {
+        // the tuples before the bad line are still loaded
+        break;
+      }
+      keys.push_back(key);
+      values.push_back(value);
+    }
+    if(keys.empty()) {
+      break;
+    }
+
+    error = rf.appendBatch(&keys[0], &values[0], keys.size(), &rids[0]);
     if(error != 0) {
-      //cerr << "Error reading line from loadfile in SqlEngine load" << endl;
+      //cerr << "Error appending lines to RecordFile in SqlEngine load" << endl;
       rf.close();
       l_file.close();
       return error;
     }
+    if(index) {
+      for(unsigned i = 0; i < keys.size(); i++) {
+        if((error = entries.add(keys[i], rids[i])) != 0) {
+          tree.close();
+          rf.close();
+          l_file.close();
+          return error;
+        }
+      }
+    }
+  } while(parseError == 0 && (int)keys.size() == LOAD_BATCH);
 
-    RecordId rid;
-    error = rf.append(key, value, rid);
+  // the index is built once all tuples are in, from its entries in key
+  // order. an empty index is built bottom-up in one pass.
+  if(index) {
+    if((error = tree.beginBulkLoad(indexFill)) == 0 &&
+       (error = entries.build(tree)) == 0) {
+      error = tree.finishBulkLoad();
+    }
     if(error != 0) {
-      //cerr << "Error appending line to RecordFile in SqlEngine load" << endl;
+      //cerr << "Error inserting index into tree in SqlEngine load" << endl;
+      tree.close();
       rf.close();
       l_file.close();
       return error;
     }
-    if(index) {
-      error = tree.insert(key, rid);
-      if(error != 0) {
-        //cerr << "Error inserting index into tree in SqlEngine load" << endl;
-        tree.close();
-        rf.close();
-        l_file.close();
-        return error;
-      }
-    }
+  }
+
+  if(parseError != 0) {
+    //cerr << "Error reading line from loadfile in SqlEngine load" << endl;
+    if(index) tree.close();
+    rf.close();
+    l_file.close();
+    return parseError;
   }
   if(index) {
     error = tree.close();
@@ -614,6 +916,182 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
   return 0;
 }
 
+RC SqlEngine::reorganize(const string& table)
+{
+  BTreeIndex btree;
+  RC rc;
+
+  PageFile::waitWarmUp();
+
+  // opening the index in 'w' mode would create it if it is missing
+  PageFile probe;
+  if ((rc = probe.open(table + ".idx", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s has no index\n", table.c_str());
+    return rc;
+  }
+  probe.close();
+
+  if ((rc = btree.open(table + ".idx", 'w')) < 0) return rc;
+  if ((rc = btree.reorganize()) < 0) {
+    fprintf(stderr, "Error: cannot reorganize the index of %s\n", table.c_str());
+  }
+  btree.close();
+
+  return rc;
+}
+
+RC SqlEngine::truncate(const string& table)
+{
+  RecordFile rf;
+  BTreeIndex btree;
+  PageFile   probe;
+  RC rc;
+
+  PageFile::waitWarmUp();
+
+  // opening the files in 'w' mode would create them if they are missing
+  if ((rc = probe.open(table + ".tbl", 'r')) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+  probe.close();
+
+  if ((rc = rf.open(table + ".tbl", 'w')) < 0) return rc;
+  if ((rc = rf.clear()) < 0) {
+    fprintf(stderr, "Error: cannot truncate table %s\n", table.c_str());
+    rf.close();
+    return rc;
+  }
+  rf.close();
+
+  if (probe.open(table + ".idx", 'r') < 0) return 0;
+  probe.close();
+
+  if ((rc = btree.open(table + ".idx", 'w')) < 0) return rc;
+  if ((rc = btree.clear()) < 0) {
+    fprintf(stderr, "Error: cannot truncate the index of %s\n", table.c_str());
+  }
+  btree.close();
+
+  return rc;
+}
+
+RC SqlEngine::showTable(const string& table)
+{
+  RecordFile rf;
+  TableStats stats;
+  ScanCursor scan;
+  int        key;
+  const char* value;
+  int        length;
+  PageId     lastPid = 0;
+  RC         rc;
+
+  if ((rc = rf.open(table + ".tbl", readMode)) < 0) {
+    fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+    return rc;
+  }
+
+  // without up-to-date statistics, count the tuples of the table
+  if (rf.getStats(stats) < 0) {
+    stats.rowCount = 0;
+    stats.pageCount = 0;
+    stats.minKey = INT_MAX;
+    stats.maxKey = INT_MIN;
+    rf.startScan(scan);
+    while ((rc = rf.readNext(scan, key, value, length)) == 0) {
+      if (stats.rowCount == 0 || scan.rid.pid != lastPid) stats.pageCount++;
+      lastPid = scan.rid.pid;
+      stats.rowCount++;
+      stats.minKey = std::min(stats.minKey, key);
+      stats.maxKey = std::max(stats.maxKey, key);
+    }
+    if (rc != RC_END_OF_FILE) {
+      fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+      rf.close();
+      return rc;
+    }
+  }
+  rf.close();
+
+  fprintf(stdout, "%10s %10s %12s %12s\n", "rows", "pages", "min_key", "max_key");
+  if (stats.rowCount == 0) {
+    fprintf(stdout, "%10d %10d %12s %12s\n", 0, stats.pageCount, "-", "-");
+  } else {
+    fprintf(stdout, "%10d %10d %12d %12d\n", stats.rowCount, stats.pageCount,
+            stats.minKey, stats.maxKey);
+  }
+  return 0;
+}
+
+RC SqlEngine::setIndexFill(int percent)
+{
+  if (percent < 1 || percent > 100) return RC_INVALID_ATTRIBUTE;
+  indexFill = percent;
+  return 0;
+}
+
+RC SqlEngine::setReadMode(char mode)
+{
+  if (mode != 'r' && mode != 'm') return RC_INVALID_FILE_MODE;
+  readMode = mode;
+  return 0;
+}
+
+void SqlEngine::beginQuery()
+{
+  vector<string> names;
+  PageFile::getFileStats(names, queryStart);
+}
+
+void SqlEngine::endQuery()
+{
+  vector<string> names;
+  PageFile::getFileStats(names, lastQuery);
+
+  // files opened for the first time during the query started from zero
+  for (unsigned i = 0; i < lastQuery.size() && i < queryStart.size(); i++) {
+    lastQuery[i].subtract(queryStart[i]);
+  }
+}
+
+RC SqlEngine::showStats(bool last, bool json)
+{
+  vector<string>  names;
+  vector<IOStats> stats;
+  IOStats total;
+
+  PageFile::getFileStats(names, stats);
+  if (last) stats = lastQuery;
+
+  // files that were not used are left out
+  bool first = true;
+  if (json) fprintf(stdout, "{\"scope\":\"%s\",\"files\":[", last ? "query" : "all");
+  else IOStats::printHeader(stdout);
+  for (unsigned i = 0; i < stats.size(); i++) {
+    const IOStats& s = stats[i];
+    if (s.hits == 0 && s.misses == 0 && s.pagesRead == 0 && s.pagesWritten == 0) continue;
+
+    if (json) {
+      if (!first) fputc(',', stdout);
+      s.printJSON(stdout, names[i].c_str());
+    } else {
+      s.print(stdout, names[i].c_str());
+    }
+    total.add(s);
+    first = false;
+  }
+  if (json) {
+    fputs("],\"total\":", stdout);
+    total.printJSON(stdout, "total");
+    fputs("}\n", stdout);
+  } else {
+    total.print(stdout, "total");
+  }
+
+  return 0;
+}
+
 RC SqlEngine::parseLoadLine(const string& line, int& key, string& value)
 {
     const char *s;
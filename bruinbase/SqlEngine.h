@@ -13,6 +13,7 @@
 #include <vector>
 #include "Bruinbase.h"
 #include "RecordFile.h"
+#include "IOStats.h"
 
 /**
  * data structure to represent a condition in the WHERE clause
@@ -55,9 +56,38 @@ class SqlEngine {
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param format[IN] the format of the pages of a new table, from the
+   *                   "AS COLUMNAR" or "AS COMPRESSED" option. SLOTTED
+   *                   keeps the format of an existing table
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC load(const std::string& table, const std::string& loadfile, bool index,
+                 RecordFile::Format format);
+
+  /**
+   * rewrite the leaves of the index of a table in key order, so that
+   * range scans over the index read its pages sequentially.
+   * @param table[IN] the table whose index is reorganized
+   * @return error code. 0 if no error
+   */
+  static RC reorganize(const std::string& table);
+
+  /**
+   * remove all tuples of a table and the entries of its index. the pages
+   * of the files are kept on their free lists and reused by the next LOAD.
+   * @param table[IN] the table to empty
+   * @return error code. 0 if no error
+   */
+  static RC truncate(const std::string& table);
+
+  /**
+   * print the statistics of a table: # tuples, # pages and the smallest
+   * and largest key. they are read from the metadata of the table, or
+   * counted with a scan if the metadata is out of date.
+   * @param table[IN] the table to describe
+   * @return error code. 0 if no error
+   */
+  static RC showTable(const std::string& table);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -67,6 +97,53 @@ class SqlEngine {
    * @return error code. 0 if no error
    */
   static RC parseLoadLine(const std::string& line, int& key, std::string& value);
+
+  /**
+   * choose how SELECT opens table and index files.
+   * @param mode[IN] 'r' to read through the buffer pool (default),
+   *                 'm' to memory-map the files
+   * @return error code. 0 if no error
+   */
+  static RC setReadMode(char mode);
+
+  /**
+   * choose how full LOAD ... WITH INDEX fills the nodes of an index that
+   * it builds from scratch.
+   * @param percent[IN] the percentage of each node to fill, from 1 to 100
+   * @return error code. 0 if no error
+   */
+  static RC setIndexFill(int percent);
+
+  /**
+   * start counting the I/O of a command. the counters of every file are
+   * remembered, so that endQuery() can tell what the command did.
+   */
+  static void beginQuery();
+
+  /**
+   * stop counting the I/O of the command started by beginQuery().
+   * the difference is kept as the statistics of the last query.
+   */
+  static void endQuery();
+
+  /**
+   * print the I/O statistics of the files, one row per file that was used
+   * and a total, or as one line of JSON.
+   * @param last[IN] true for the I/O of the last query,
+   *                 false for all I/O since the start
+   * @param json[IN] true to print JSON instead of a table
+   * @return error code. 0 if no error
+   */
+  static RC showStats(bool last, bool json);
+
+ private:
+  static char readMode;  // the PageFile mode SELECT opens files in
+  static int  indexFill; // the fill factor of an index LOAD builds, in %
+
+  static const int LOAD_BATCH = 1024;  // # tuples LOAD appends at once
+
+  static std::vector<IOStats> queryStart;  // file counters at beginQuery()
+  static std::vector<IOStats> lastQuery;   // the I/O of each file in the last query
 };
 
 #endif /* SQLENGINE_H */
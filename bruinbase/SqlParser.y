@@ -21,13 +21,69 @@ static void runSelect(int attr, const char* table, const std::vector<SelCond>& c
 
   btime = times(&tmsbuf);
   bpagecnt = PageFile::getPageReadCount();
+  SqlEngine::beginQuery();
   SqlEngine::select(attr, table, conds);
+  SqlEngine::endQuery();
   etime = times(&tmsbuf);
   epagecnt = PageFile::getPageReadCount();
 
   fprintf(stderr, "  -- %.3f seconds to run the select command. Read %d pages\n", ((float)(etime - btime))/sysconf(_SC_CLK_TCK), epagecnt - bpagecnt);
 }
 
+// LOAD ... AS COLUMNAR and LOAD ... AS COMPRESSED store a new table in
+// the COLUMNAR or COMPRESSED format
+static void runLoad(const char* table, const char* loadfile, bool index,
+                    const char* as = 0, const char* format = 0)
+{
+  RecordFile::Format f = RecordFile::SLOTTED;
+  if (as && strcmp(as, "as") == 0 && strcmp(format, "columnar") == 0) {
+    f = RecordFile::COLUMNAR;
+  } else if (as && strcmp(as, "as") == 0 && strcmp(format, "compressed") == 0) {
+    f = RecordFile::COMPRESSED;
+  } else if (as) {
+    sqlerror("LOAD takes AS COLUMNAR or AS COMPRESSED");
+    return;
+  }
+
+  SqlEngine::beginQuery();
+  SqlEngine::load(std::string(table), std::string(loadfile), index, f);
+  SqlEngine::endQuery();
+}
+
+// SHOW STATS [JSON] prints the I/O of each file since the start,
+// SHOW QUERY [JSON] the I/O of each file in the last SELECT or LOAD,
+// SHOW TABLE table the statistics of a table
+static void runShow(const char* what, const char* format)
+{
+  bool json = format && strcmp(format, "json") == 0;
+  if (strcmp(what, "table") == 0 && format) {
+    SqlEngine::showTable(format);
+  } else if (format && !json) {
+    sqlerror("syntax error");
+  } else if (strcmp(what, "stats") == 0) {
+    SqlEngine::showStats(false, json);
+  } else if (strcmp(what, "query") == 0) {
+    SqlEngine::showStats(true, json);
+  } else {
+    sqlerror("SHOW takes STATS, QUERY or TABLE");
+  }
+}
+
+// the commands made only of words, which the lexer returns as IDs:
+// SHOW ..., REORGANIZE table and TRUNCATE table
+static void runWords(const char* first, const char* second, const char* third)
+{
+  if (strcmp(first, "show") == 0) {
+    runShow(second, third);
+  } else if (strcmp(first, "reorganize") == 0 && !third) {
+    SqlEngine::reorganize(second);
+  } else if (strcmp(first, "truncate") == 0 && !third) {
+    SqlEngine::truncate(second);
+  } else {
+    sqlerror("syntax error");
+  }
+}
+
 %}
 
 %union {
@@ -56,6 +112,7 @@ commands:
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
+	| word_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
@@ -67,15 +124,43 @@ quit_command:
 
 load_command:
 	LOAD table FROM STRING LF { 
-	  SqlEngine::load(std::string($2), std::string($4), false); 
+	  runLoad($2, $4, false); 
 	  free($2);
 	  free($4);
 	}
 	| LOAD table FROM STRING WITH INDEX LF { 
-	  SqlEngine::load(std::string($2), std::string($4), true); 
+	  runLoad($2, $4, true); 
 	  free($2);
 	  free($4);
 	}
+	| LOAD table FROM STRING ID ID LF {
+	  runLoad($2, $4, false, $5, $6);
+	  free($2);
+	  free($4);
+	  free($5);
+	  free($6);
+	}
+	| LOAD table FROM STRING WITH INDEX ID ID LF {
+	  runLoad($2, $4, true, $7, $8);
+	  free($2);
+	  free($4);
+	  free($7);
+	  free($8);
+	}
+	;
+
+word_command:
+	ID ID LF {
+	  runWords($1, $2, 0);
+	  free($1);
+	  free($2);
+	}
+	| ID ID ID LF {
+	  runWords($1, $2, $3);
+	  free($1);
+	  free($2);
+	  free($3);
+	}
 	;
 
 select_command:
@@ -0,0 +1,324 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "Bruinbase.h"
+#include "StorageBackend.h"
+#include "IOStats.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using std::string;
+
+// the kind of backend create() returns
+static enum { FILE_BACKEND, MEMORY_BACKEND, SIMULATED_DISK } defaultKind = FILE_BACKEND;
+
+ssize_t StorageBackend::read(void* buffer, size_t length, off_t offset)
+{
+  struct iovec iov;
+  iov.iov_base = buffer;
+  iov.iov_len = length;
+  return readv(&iov, 1, offset);
+}
+
+ssize_t StorageBackend::write(const void* buffer, size_t length, off_t offset)
+{
+  struct iovec iov;
+  iov.iov_base = (void*)buffer;
+  iov.iov_len = length;
+  return writev(&iov, 1, offset);
+}
+
+RC StorageBackend::readBatch(AsyncIO::Request* reqs, int count)
+{
+  RC rc = 0;
+  for (int i = 0; i < count; i++) {
+    ssize_t bytes = read(reqs[i].buffer, reqs[i].length, reqs[i].offset);
+    reqs[i].rc = (bytes == reqs[i].length) ? 0 : RC_FILE_READ_FAILED;
+    if (reqs[i].rc < 0) rc = reqs[i].rc;
+  }
+  return rc;
+}
+
+RC StorageBackend::setDefault(const string& spec)
+{
+  long long latency;
+  int       mbPerSec;
+  char      extra;
+
+  if (spec == "file") {
+    defaultKind = FILE_BACKEND;
+  } else if (spec == "memory") {
+    defaultKind = MEMORY_BACKEND;
+  } else if (sscanf(spec.c_str(), "sim:%lld,%d%c", &latency, &mbPerSec, &extra) == 2 &&
+             latency >= 0 && mbPerSec >= 0) {
+    SimulatedDisk::setSpeed(latency, mbPerSec);
+    defaultKind = SIMULATED_DISK;
+  } else {
+    return RC_INVALID_ATTRIBUTE;
+  }
+  return 0;
+}
+
+StorageBackend* StorageBackend::create()
+{
+  switch (defaultKind) {
+  case MEMORY_BACKEND:
+    return new MemoryBackend;
+  case SIMULATED_DISK:
+    return new SimulatedDisk;
+  default:
+    return new FileBackend;
+  }
+}
+
+//
+// FileBackend
+//
+
+RC FileBackend::open(const string& name, bool write)
+{
+  if (fd >= 0) return RC_FILE_OPEN_FAILED;
+  fd = ::open(name.c_str(), write ? (O_RDWR|O_CREAT) : O_RDONLY, 0644);
+  return (fd < 0) ? RC_FILE_OPEN_FAILED : 0;
+}
+
+RC FileBackend::close()
+{
+  if (fd < 0) return RC_FILE_CLOSE_FAILED;
+  int rc = ::close(fd);
+  fd = -1;
+  return (rc < 0) ? RC_FILE_CLOSE_FAILED : 0;
+}
+
+RC FileBackend::getSize(off_t& size)
+{
+  struct stat statbuf;
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_OPEN_FAILED;
+  size = statbuf.st_size;
+  return 0;
+}
+
+void FileBackend::getId(dev_t& dev, ino_t& ino)
+{
+  struct stat statbuf;
+  if (::fstat(fd, &statbuf) < 0) {
+    dev = 0;
+    ino = 0;
+    return;
+  }
+  dev = statbuf.st_dev;
+  ino = statbuf.st_ino;
+}
+
+ssize_t FileBackend::readv(const struct iovec* iov, int count, off_t offset)
+{
+  return ::preadv(fd, iov, count, offset);
+}
+
+ssize_t FileBackend::writev(const struct iovec* iov, int count, off_t offset)
+{
+  return ::pwritev(fd, iov, count, offset);
+}
+
+RC FileBackend::truncate(off_t size)
+{
+  return (::ftruncate(fd, size) < 0) ? RC_FILE_WRITE_FAILED : 0;
+}
+
+RC FileBackend::readBatch(AsyncIO::Request* reqs, int count)
+{
+  for (int i = 0; i < count; i++) reqs[i].fd = fd;
+  return AsyncIO::readBatch(reqs, count);
+}
+
+bool FileBackend::setDirect()
+{
+  int flags = ::fcntl(fd, F_GETFL);
+  return flags >= 0 && ::fcntl(fd, F_SETFL, flags | O_DIRECT) == 0;
+}
+
+void FileBackend::setSequential(bool on)
+{
+  ::posix_fadvise(fd, 0, 0, on ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_NORMAL);
+}
+
+//
+// MemoryBackend
+//
+
+// a file in memory. the files are never freed, so that a file closed and
+// opened again still has its data.
+struct MemoryBackend::MemFile {
+  std::vector<char> data;  // the bytes of the file
+  ino_t           ino;     // the number of the file, from 1
+  pthread_mutex_t lock;    // protects data
+};
+
+// the memory files by name, protected by memLock
+static std::map<string, MemoryBackend::MemFile*> memFiles;
+static pthread_mutex_t memLock = PTHREAD_MUTEX_INITIALIZER;
+
+// the device number of memory files, which no unix file has
+static const dev_t MEMORY_DEV = (dev_t)-1;
+
+RC MemoryBackend::open(const string& name, bool write)
+{
+  if (file) return RC_FILE_OPEN_FAILED;
+
+  pthread_mutex_lock(&memLock);
+  std::map<string, MemFile*>::iterator it = memFiles.find(name);
+  if (it != memFiles.end()) {
+    file = it->second;
+  } else if (write) {
+    file = new MemFile;
+    file->ino = memFiles.size() + 1;
+    pthread_mutex_init(&file->lock, NULL);
+    memFiles[name] = file;
+  }
+  pthread_mutex_unlock(&memLock);
+
+  return file ? 0 : RC_FILE_OPEN_FAILED;
+}
+
+RC MemoryBackend::close()
+{
+  if (file == 0) return RC_FILE_CLOSE_FAILED;
+  file = 0;
+  return 0;
+}
+
+RC MemoryBackend::getSize(off_t& size)
+{
+  pthread_mutex_lock(&file->lock);
+  size = file->data.size();
+  pthread_mutex_unlock(&file->lock);
+  return 0;
+}
+
+void MemoryBackend::getId(dev_t& dev, ino_t& ino)
+{
+  dev = MEMORY_DEV;
+  ino = file->ino;
+}
+
+ssize_t MemoryBackend::readv(const struct iovec* iov, int count, off_t offset)
+{
+  ssize_t bytes = 0;
+
+  pthread_mutex_lock(&file->lock);
+  for (int i = 0; i < count; i++) {
+    off_t  size = file->data.size();
+    size_t n = (offset >= size) ? 0 : std::min((off_t)iov[i].iov_len, size - offset);
+    if (n > 0) memcpy(iov[i].iov_base, &file->data[offset], n);
+    bytes += n;
+    offset += n;
+    if (n < iov[i].iov_len) break;
+  }
+  pthread_mutex_unlock(&file->lock);
+
+  return bytes;
+}
+
+ssize_t MemoryBackend::writev(const struct iovec* iov, int count, off_t offset)
+{
+  size_t length = 0;
+  for (int i = 0; i < count; i++) length += iov[i].iov_len;
+
+  pthread_mutex_lock(&file->lock);
+  if (file->data.size() < offset + length) file->data.resize(offset + length);
+  for (int i = 0; i < count; i++) {
+    memcpy(&file->data[offset], iov[i].iov_base, iov[i].iov_len);
+    offset += iov[i].iov_len;
+  }
+  pthread_mutex_unlock(&file->lock);
+
+  return length;
+}
+
+RC MemoryBackend::truncate(off_t size)
+{
+  pthread_mutex_lock(&file->lock);
+  file->data.resize(size);
+  pthread_mutex_unlock(&file->lock);
+  return 0;
+}
+
+//
+// SimulatedDisk
+//
+
+// the speed of the simulated disk, and the time when it finishes the I/O
+// queued on it so far. protected by diskLock.
+static long long diskLatency = 0;   // microseconds per I/O
+static long long diskBandwidth = 0; // bytes per second, 0 for no limit
+static long long diskFreeTime = 0;  // IOStats::now() when the disk is idle
+static pthread_mutex_t diskLock = PTHREAD_MUTEX_INITIALIZER;
+
+void SimulatedDisk::setSpeed(long long latency, int mbPerSec)
+{
+  pthread_mutex_lock(&diskLock);
+  diskLatency = latency;
+  diskBandwidth = (long long)mbPerSec * 1024 * 1024;
+  pthread_mutex_unlock(&diskLock);
+}
+
+void SimulatedDisk::wait(long long bytes)
+{
+  // the I/O starts when the disk is done with the I/O queued before it
+  pthread_mutex_lock(&diskLock);
+  long long cost = diskLatency;
+  if (diskBandwidth > 0) cost += bytes * 1000000 / diskBandwidth;
+  long long done = std::max(IOStats::now(), diskFreeTime) + cost;
+  diskFreeTime = done;
+  pthread_mutex_unlock(&diskLock);
+
+  struct timespec ts;
+  ts.tv_sec = done / 1000000;
+  ts.tv_nsec = (done % 1000000) * 1000;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {}
+}
+
+ssize_t SimulatedDisk::readv(const struct iovec* iov, int count, off_t offset)
+{
+  ssize_t bytes = FileBackend::readv(iov, count, offset);
+  if (bytes > 0) wait(bytes);
+  return bytes;
+}
+
+ssize_t SimulatedDisk::writev(const struct iovec* iov, int count, off_t offset)
+{
+  ssize_t bytes = FileBackend::writev(iov, count, offset);
+  if (bytes > 0) wait(bytes);
+  return bytes;
+}
+
+RC SimulatedDisk::readBatch(AsyncIO::Request* reqs, int count)
+{
+  // the reads of a batch are queued on the disk together, so they share
+  // one latency as on a device that overlaps its requests
+  RC rc = 0;
+  long long bytes = 0;
+  for (int i = 0; i < count; i++) {
+    struct iovec iov;
+    iov.iov_base = reqs[i].buffer;
+    iov.iov_len = reqs[i].length;
+    ssize_t n = FileBackend::readv(&iov, 1, reqs[i].offset);
+    reqs[i].rc = (n == reqs[i].length) ? 0 : RC_FILE_READ_FAILED;
+    if (reqs[i].rc < 0) rc = reqs[i].rc;
+    else bytes += n;
+  }
+  if (bytes > 0) wait(bytes);
+  return rc;
+}
@@ -0,0 +1,209 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef STORAGEBACKEND_H
+#define STORAGEBACKEND_H
+
+#include <string>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "Bruinbase.h"
+#include "AsyncIO.h"
+
+/**
+ * the storage under a PageFile: something that reads and writes bytes
+ * at offsets. PageFile does all of its I/O through a StorageBackend, so
+ * the same files can live on disk, in memory, or on a simulated disk.
+ *
+ * the backend of new PageFiles is chosen with setDefault():
+ *  - "file": a unix file (the default).
+ *  - "memory": a buffer in memory, named like a file. the data lives
+ *    until the process exits, so it suits temporary tables.
+ *  - "sim:<latency_us>,<MB/s>": a unix file behind a simulated disk that
+ *    makes every I/O wait for a fixed latency plus its size divided by
+ *    the bandwidth. the disk serves one I/O at a time, so a workload
+ *    takes about the same time on any machine. a bandwidth of 0 means
+ *    no limit.
+ *
+ * a backend may be used by several threads at once (pages are written
+ * back by whichever thread evicts them).
+ */
+class StorageBackend {
+ public:
+  virtual ~StorageBackend() {}
+
+  /**
+   * open the named storage.
+   * @param name[IN] the name of the file
+   * @param write[IN] true to allow writes, creating the file if missing
+   * @return error code. 0 if no error
+   */
+  virtual RC open(const std::string& name, bool write) = 0;
+
+  /**
+   * close the storage.
+   * @return error code. 0 if no error
+   */
+  virtual RC close() = 0;
+
+  /**
+   * @param size[OUT] the size of the storage in bytes
+   * @return error code. 0 if no error
+   */
+  virtual RC getSize(off_t& size) = 0;
+
+  /**
+   * get the numbers that identify the storage, the same for every open
+   * of the same file: the device and inode of a unix file.
+   * @param dev[OUT] the device number
+   * @param ino[OUT] the inode number
+   */
+  virtual void getId(dev_t& dev, ino_t& ino) = 0;
+
+  /**
+   * read into several buffers from consecutive bytes, like preadv().
+   * @return # bytes read, short at the end of the storage. -1 on error
+   */
+  virtual ssize_t readv(const struct iovec* iov, int count, off_t offset) = 0;
+
+  /**
+   * write several buffers to consecutive bytes, like pwritev().
+   * the storage grows as needed.
+   * @return # bytes written. -1 on error
+   */
+  virtual ssize_t writev(const struct iovec* iov, int count, off_t offset) = 0;
+
+  /**
+   * cut the storage to a size, like ftruncate().
+   * @param size[IN] the new size in bytes
+   * @return error code. 0 if no error
+   */
+  virtual RC truncate(off_t size) = 0;
+
+  /**
+   * read one buffer, like pread().
+   */
+  ssize_t read(void* buffer, size_t length, off_t offset);
+
+  /**
+   * write one buffer, like pwrite().
+   */
+  ssize_t write(const void* buffer, size_t length, off_t offset);
+
+  /**
+   * run a batch of reads and wait for all of them. the fd of the requests
+   * is ignored. by default the reads run one after the other.
+   * @param reqs[IN/OUT] the reads. rc of each is set on completion
+   * @param count[IN] # reads in reqs
+   * @return error code. 0 if every read succeeded
+   */
+  virtual RC readBatch(AsyncIO::Request* reqs, int count);
+
+  /**
+   * @return the unix file descriptor that can be memory-mapped, or -1 if
+   *         the storage cannot be mapped
+   */
+  virtual int getFd() const { return -1; }
+
+  /**
+   * bypass the kernel page cache (O_DIRECT) from now on, if possible.
+   * @return true if direct I/O is on
+   */
+  virtual bool setDirect() { return false; }
+
+  /**
+   * tell the storage whether it is about to be read in order.
+   */
+  virtual void setSequential(bool /*on*/) {}
+
+  /**
+   * choose the backend of the PageFiles opened from now on.
+   * @param spec[IN] "file", "memory" or "sim:<latency_us>,<MB/s>"
+   * @return error code. 0 if no error
+   */
+  static RC setDefault(const std::string& spec);
+
+  /**
+   * @return a new, unopened backend of the kind chosen by setDefault()
+   */
+  static StorageBackend* create();
+};
+
+/**
+ * a unix file
+ */
+class FileBackend : public StorageBackend {
+ public:
+  FileBackend() : fd(-1) {}
+  ~FileBackend() { if (fd >= 0) close(); }
+
+  RC open(const std::string& name, bool write);
+  RC close();
+  RC getSize(off_t& size);
+  void getId(dev_t& dev, ino_t& ino);
+  ssize_t readv(const struct iovec* iov, int count, off_t offset);
+  ssize_t writev(const struct iovec* iov, int count, off_t offset);
+  RC truncate(off_t size);
+  RC readBatch(AsyncIO::Request* reqs, int count);
+  int getFd() const { return fd; }
+  bool setDirect();
+  void setSequential(bool on);
+
+ private:
+  int fd;  // the file descriptor, -1 if not open
+};
+
+/**
+ * a file kept in memory. the files are shared by name among all
+ * MemoryBackends of the process.
+ */
+class MemoryBackend : public StorageBackend {
+ public:
+  MemoryBackend() : file(0) {}
+
+  RC open(const std::string& name, bool write);
+  RC close();
+  RC getSize(off_t& size);
+  void getId(dev_t& dev, ino_t& ino);
+  ssize_t readv(const struct iovec* iov, int count, off_t offset);
+  ssize_t writev(const struct iovec* iov, int count, off_t offset);
+  RC truncate(off_t size);
+
+  struct MemFile;
+
+ private:
+  MemFile* file;  // the open file, NULL if none
+};
+
+/**
+ * a unix file on a simulated disk with a fixed latency and bandwidth.
+ * the file cannot be memory-mapped, since reads from the mapping would
+ * not wait for the simulated disk.
+ */
+class SimulatedDisk : public FileBackend {
+ public:
+  ssize_t readv(const struct iovec* iov, int count, off_t offset);
+  ssize_t writev(const struct iovec* iov, int count, off_t offset);
+  RC readBatch(AsyncIO::Request* reqs, int count);
+  int getFd() const { return -1; }
+
+  /**
+   * set the speed of the simulated disk.
+   * @param latency[IN] the time every I/O takes, in microseconds
+   * @param mbPerSec[IN] the bandwidth in MB/s, 0 for no limit
+   */
+  static void setSpeed(long long latency, int mbPerSec);
+
+ private:
+  /**
+   * wait until the simulated disk has transferred some bytes in one I/O
+   * after the I/O already queued on it.
+   * @param bytes[IN] the size of the I/O
+   */
+  static void wait(long long bytes);
+};
+
+#endif // STORAGEBACKEND_H
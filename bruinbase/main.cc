@@ -9,12 +9,112 @@
  
 #include "Bruinbase.h"
 #include "SqlEngine.h"
+#include "PageFile.h"
+#include "PageTrace.h"
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
 
-int main()
+int main(int argc, char* argv[])
 {
+  int  c;
+  bool stats = false;
+  const char* warmFile = 0;
+
+  // -m <MB> sets the size of the buffer pool
+  // -M memory-maps table and index files for SELECT
+  // -p <bytes> sets the page size of newly created files
+  // -d reads and writes files with O_DIRECT (page sizes of 4096 and up)
+  // -r <lru|2q> sets the page replacement policy of the buffer pool
+  // -s prints buffer pool statistics at exit, to compare policies
+  // -t <file> records every page access to a trace file for simtrace
+  // -w <file> reads the pages listed in the file into the buffer pool in
+  //    the background, and lists the cached pages in it again at exit
+  // -b <file|memory|sim:latency_us,MB/s> sets where table and index files
+  //    are stored: on disk, in memory, or on a simulated disk
+  // -f <percent> sets how full LOAD ... WITH INDEX fills the nodes of a
+  //    new index
+  while ((c = getopt(argc, argv, "m:Mp:dr:st:w:b:f:")) != -1) {
+    switch (c) {
+    case 'm':
+      if (PageFile::setCacheSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid buffer pool size %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'M':
+      SqlEngine::setReadMode('m');
+      break;
+    case 'p':
+      if (PageFile::setDefaultPageSize(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid page size %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'd':
+      PageFile::setDirectIO(true);
+      break;
+    case 'r':
+      if (strcmp(optarg, "lru") == 0) {
+        PageFile::setReplacementPolicy(BufferPool::LRU);
+      } else if (strcmp(optarg, "2q") == 0) {
+        PageFile::setReplacementPolicy(BufferPool::TWO_Q);
+      } else {
+        fprintf(stderr, "Error: invalid replacement policy %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 's':
+      stats = true;
+      break;
+    case 't':
+      if (PageTrace::start(optarg) < 0) {
+        fprintf(stderr, "Error: cannot create trace file %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'w':
+      warmFile = optarg;
+      break;
+    case 'b':
+      if (PageFile::setStorage(optarg) < 0) {
+        fprintf(stderr, "Error: invalid storage %s\n", optarg);
+        return 1;
+      }
+      break;
+    case 'f':
+      if (SqlEngine::setIndexFill(atoi(optarg)) < 0) {
+        fprintf(stderr, "Error: invalid fill factor %s\n", optarg);
+        return 1;
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-m buffer_pool_MB] [-M] [-p page_size] [-d] [-r lru|2q] [-s] [-t trace_file] [-w warmup_file] [-b file|memory|sim:latency_us,MBps] [-f fill_percent]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  // a missing warm-up file is normal on the first run
+  if (warmFile) PageFile::warmUp(warmFile);
+
   // run the SQL engine taking user commands from standard input (console).
   SqlEngine::run(stdin);
 
+  // write back whatever is still dirty in the buffer pool, and remember
+  // what is cached for the next start
+  PageFile::waitWarmUp();
+  PageFile::flushAll();
+  if (warmFile && PageFile::saveCachedPages(warmFile) < 0) {
+    fprintf(stderr, "Error: cannot write warm-up file %s\n", warmFile);
+  }
+  PageTrace::stop();
+
+  if (stats) {
+    fprintf(stderr, "Buffer pool: %d hits, %d misses, %d pages read, %d pages written\n",
+            PageFile::getCacheHitCount(), PageFile::getCacheMissCount(),
+            PageFile::getPageReadCount(), PageFile::getPageWriteCount());
+  }
+
   return 0;
 }
@@ -0,0 +1,158 @@
+/**
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * simtrace: replay a page access trace recorded with "bruinbase -t"
+ * against buffer pools of several sizes and both replacement policies,
+ * and report the hit ratio of each.
+ *
+ * the real BufferPool class is used, with one pool per page size as
+ * PageFile has (PageFile splits each pool into shards; the hit ratio of
+ * the shards together is close to that of one pool of the same size).
+ * a read of a page that is not cached is a miss. a write of a page that
+ * is not cached takes a frame without a miss, as in PageFile::write().
+ */
+
+#include "Bruinbase.h"
+#include "BufferPool.h"
+#include "PageTrace.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+
+using std::vector;
+
+static const int POOL_COUNT = 5;  // page sizes of 1KB to 16KB
+
+// # pages the pools wrote back in the current replay
+static long long pagesWritten = 0;
+
+static RC countWrite(int file, PageId pid, const struct iovec* iov, int count)
+{
+  pagesWritten += count;
+  return 0;
+}
+
+// replay the trace against pools of mb megabytes per page size
+static void replay(const vector<PageTrace::Record>& trace, int mb,
+                   BufferPool::Policy policy)
+{
+  BufferPool* pools[POOL_COUNT] = { 0 };
+  long long hits = 0, misses = 0;
+
+  pagesWritten = 0;
+  for (unsigned i = 0; i < trace.size(); i++) {
+    const PageTrace::Record& r = trace[i];
+    if (r.sizeShift >= POOL_COUNT) continue;
+
+    BufferPool*& pool = pools[r.sizeShift];
+    if (pool == 0) {
+      int size = 1024 << r.sizeShift;
+      pool = new BufferPool(size, std::max((long)mb * 1024 * 1024 / size, 1L), countWrite);
+      pool->setPolicy(policy);
+    }
+
+    int frame;
+    if (r.op == PageTrace::READ) {
+      frame = pool->lookup(r.file, r.pid);
+      if (frame >= 0) {
+        hits++;
+      } else {
+        misses++;
+        if (pool->allocate(r.file, r.pid, frame) < 0) continue;
+      }
+    } else {
+      frame = pool->find(r.file, r.pid);
+      if (frame >= 0) {
+        pool->touch(frame);
+      } else if (pool->allocate(r.file, r.pid, frame) < 0) {
+        continue;
+      }
+      pool->markDirty(frame);
+    }
+  }
+
+  // dirty pages left at the end are written by the final checkpoint
+  for (int i = 0; i < POOL_COUNT; i++) {
+    if (pools[i] == 0) continue;
+    pools[i]->flush(-1);
+    delete pools[i];
+  }
+
+  long long total = hits + misses;
+  printf("%8d %6s %12lld %12lld %9.2f%% %12lld\n", mb,
+         policy == BufferPool::LRU ? "lru" : "2q", hits, misses,
+         total ? 100.0 * hits / total : 0.0, pagesWritten);
+}
+
+int main(int argc, char* argv[])
+{
+  int c;
+  vector<int> sizes;
+
+  // -m <MB,MB,...> the pool sizes to try
+  while ((c = getopt(argc, argv, "m:")) != -1) {
+    switch (c) {
+    case 'm':
+      for (char* s = strtok(optarg, ","); s; s = strtok(0, ",")) {
+        if (atoi(s) > 0) sizes.push_back(atoi(s));
+      }
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-m MB,MB,...] trace_file\n", argv[0]);
+      return 1;
+    }
+  }
+  if (optind != argc - 1) {
+    fprintf(stderr, "usage: %s [-m MB,MB,...] trace_file\n", argv[0]);
+    return 1;
+  }
+  if (sizes.empty()) {
+    for (int mb = 1; mb <= 64; mb *= 2) sizes.push_back(mb);
+  }
+
+  // load the whole trace; a record is only 16 bytes
+  FILE* f = fopen(argv[optind], "rb");
+  if (f == 0) {
+    fprintf(stderr, "Error: cannot open %s\n", argv[optind]);
+    return 1;
+  }
+  if (PageTrace::readHeader(f) < 0) {
+    fprintf(stderr, "Error: %s is not a page trace\n", argv[optind]);
+    fclose(f);
+    return 1;
+  }
+  vector<PageTrace::Record> trace;
+  PageTrace::Record r;
+  while (fread(&r, sizeof(r), 1, f) == 1) trace.push_back(r);
+  fclose(f);
+
+  // summarize the trace
+  std::set<std::pair<int, PageId> > pages;
+  long long reads = 0;
+  for (unsigned i = 0; i < trace.size(); i++) {
+    pages.insert(std::make_pair((int)trace[i].file, trace[i].pid));
+    if (trace[i].op == PageTrace::READ) reads++;
+  }
+  printf("%lu accesses (%lld reads, %lld writes) to %lu distinct pages over %.3f seconds\n",
+         (unsigned long)trace.size(), reads, (long long)trace.size() - reads,
+         (unsigned long)pages.size(),
+         trace.empty() ? 0.0 : trace.back().time / 1e6);
+
+  printf("%8s %6s %12s %12s %10s %12s\n", "pool_MB", "policy", "hits", "misses",
+         "hit_ratio", "pg_write");
+  for (unsigned i = 0; i < sizes.size(); i++) {
+    replay(trace, sizes[i], BufferPool::LRU);
+    replay(trace, sizes[i], BufferPool::TWO_Q);
+  }
+
+  return 0;
+}
@@ -5,6 +5,9 @@ rm -f small.tbl small.idx
 rm -f medium.tbl medium.idx
 rm -f large.tbl large.idx
 rm -f xlarge.tbl xlarge.idx
+rm -f lcolumnar.tbl lcompressed.tbl
+rm -f xcolumnar.tbl xcolumnar.idx
+rm -f xcompressed.tbl xcompressed.idx
 
 ./bruinbase < test.sql
 
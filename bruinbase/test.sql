@@ -20,3 +20,34 @@ SELECT COUNT(*) FROM xlarge
 SELECT * FROM xlarge WHERE key = 4240
 SELECT * FROM xlarge WHERE key > 400 AND key < 500 AND key > 100 AND key < 4000000
 
+
+TRUNCATE small
+SELECT COUNT(*) FROM small
+LOAD small FROM 'small.del' WITH INDEX
+SELECT COUNT(*) FROM small
+SELECT * FROM small WHERE key > 100 AND key < 500
+
+LOAD lcolumnar FROM 'large.del' AS COLUMNAR
+SELECT COUNT(*) FROM lcolumnar
+SELECT key FROM lcolumnar WHERE key > 4500
+SELECT * FROM lcolumnar WHERE value > 'Wi' AND value < 'Wo'
+SHOW TABLE lcolumnar
+
+LOAD lcompressed FROM 'large.del' AS COMPRESSED
+SELECT COUNT(*) FROM lcompressed
+SELECT key FROM lcompressed WHERE key > 4500
+SELECT * FROM lcompressed WHERE value > 'Wi' AND value < 'Wo'
+SHOW TABLE lcompressed
+
+LOAD xcolumnar FROM 'xlarge.del' WITH INDEX AS COLUMNAR
+SELECT * FROM xcolumnar WHERE key > 400 AND key < 500
+SELECT COUNT(*) FROM xcolumnar WHERE key > 4000 AND value > 'T'
+
+LOAD xcompressed FROM 'xlarge.del' WITH INDEX AS COMPRESSED
+SELECT * FROM xcompressed WHERE key > 400 AND key < 500
+SELECT COUNT(*) FROM xcompressed WHERE key > 4000 AND value > 'T'
+
+REORGANIZE xlarge
+SELECT * FROM xlarge WHERE key > 400 AND key < 500
+SELECT COUNT(*) FROM xlarge WHERE key > 4000 AND value > 'T'
+SHOW TABLE xlarge